@@ -0,0 +1,330 @@
+// Benchmark suite of the engine: intersection routines and camera rays (the
+// _float rows in single precision), material scattering, bvh builds over
+// random_scene scaled up and full-frame renders of the example scenes at a
+// fixed seed. Results are printed as CSV (default) or JSON so runs can be
+// compared. hittable_list_hit and the _scatter rows go through the virtual
+// calls of the class hierarchy, closed_list_hit and the _scatter_closed rows
+// through the switch of primitive_array and scatter_material. aabb_hit
+// counts slab tests, bvh_node_tests and linear_bvh_node_tests the nodes
+// visited by closest hit queries (rays without ray statistics). The sah_build
+// and lbvh_build rows count primitives in the rays column and give the SAH
+// cost of the tree built. The render_wavefront_ rows trace the same frames
+// with the wavefront integrator, the render_packets_ rows with the camera
+// rays of the megakernel intersected by ray_packet.
+//
+//   engine_bench [--json] [--out=file] [--data=dir] [--spp=N] [--repeats=N]
+//                [--build-extents=11,50,160]
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+
+struct bench_result {
+    std::string name;
+    double rays;     // rays traced, tested or generated by one run
+    double seconds;  // best run
+    double sah_cost; // build rows, 0 for the others
+};
+
+// Best time of `repeats` runs of f, so a noisy run does not hide a regression
+template <typename F>
+double best_seconds(int repeats, F f) {
+    double best = infinity;
+    for (int i = 0; i < repeats; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+        if (d.count() < best) best = d.count();
+    }
+    return best;
+}
+
+// Keeps the benchmarked results alive
+static volatile double sink;
+
+// Rays shot from around the camera of the example scenes into the scene
+std::vector<ray> scene_rays(int n) {
+    std::vector<ray> rays;
+    rays.reserve(n);
+    for (int i = 0; i < n; i++) {
+        point3 origin(13 + random_double(-1, 1), 2 + random_double(-1, 1), 3 + random_double(-1, 1));
+        point3 target(random_double(-11, 11), random_double(0, 1), random_double(-11, 11));
+        rays.push_back(ray(origin, target - origin, random_double()));
+    }
+    return rays;
+}
+
+// Hit records on a unit sphere, inputs of the material benchmarks
+std::vector<std::pair<ray, hit_record>> sphere_hits(int n) {
+    sphere unit(point3(0, 0, 0), 1.0);
+    std::vector<std::pair<ray, hit_record>> hits;
+    hits.reserve(n);
+    while ((int) hits.size() < n) {
+        point3 origin = 3 * random_unit_vector();
+        ray r(origin, random_in_unit_sphere() - origin, 0.0);
+        hit_record rec;
+        if (unit.hit(r, 0.001, infinity, rec)) hits.push_back(std::make_pair(r, rec));
+    }
+    return hits;
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    std::string out_file, data_dir = "data";
+    int spp = 2, repeats = 3;
+    std::vector<int> build_extents = { 11, 50, 160 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) json = true;
+        else if (strncmp(argv[i], "--out=", 6) == 0) out_file = argv[i]+6;
+        else if (strncmp(argv[i], "--data=", 7) == 0) data_dir = argv[i]+7;
+        else if (strncmp(argv[i], "--spp=", 6) == 0) spp = atoi(argv[i]+6);
+        else if (strncmp(argv[i], "--repeats=", 10) == 0) repeats = atoi(argv[i]+10);
+        else if (strncmp(argv[i], "--build-extents=", 16) == 0) {
+            build_extents.clear();
+            for (const char* p = argv[i]+16; *p; p = strchr(p, ',') ? strchr(p, ',') + 1 : p + strlen(p))
+                if (atoi(p) > 0) build_extents.push_back(atoi(p));
+        }
+        else {
+            fprintf(stderr, "usage: %s [--json] [--out=file] [--data=dir] [--spp=N] [--repeats=N] "
+                            "[--build-extents=N,N,...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (repeats < 1) repeats = 1;
+    if (spp < 1) spp = 1;
+
+    std::vector<bench_result> results;
+    auto run = [&](const std::string& name, double rays, auto f) {
+        results.push_back({ name, rays, best_seconds(repeats, f), 0.0 });
+    };
+
+    seed_thread_rng(2022, 0);
+    hittable_list world = random_scene();
+    std::vector<ray> rays = scene_rays(100000);
+    const int n_tests = 2000000;
+
+    // Primitive intersection, ray i against object i of the scene
+    std::vector<shared_ptr<sphere>> spheres;
+    std::vector<shared_ptr<moving_sphere>> moving_spheres;
+    std::vector<aabb> boxes;
+    for (auto & object : world.objects) {
+        if (auto s = std::dynamic_pointer_cast<sphere>(object)) spheres.push_back(s);
+        if (auto m = std::dynamic_pointer_cast<moving_sphere>(object)) moving_spheres.push_back(m);
+        aabb box;
+        object->bounding_box(0, 1, box);
+        boxes.push_back(box);
+    }
+
+    run("sphere_hit", n_tests, [&]() {
+        hit_record rec;
+        int hits = 0;
+        for (int i = 0; i < n_tests; i++)
+            hits += spheres[i % spheres.size()]->hit(rays[i % rays.size()], 0.001, infinity, rec);
+        sink = hits;
+    });
+
+    // Same tests in single precision
+    std::vector<rayf> rays_float(rays.begin(), rays.end());
+    run("sphere_hit_float", n_tests, [&]() {
+        hit_recordf rec;
+        int hits = 0;
+        for (int i = 0; i < n_tests; i++)
+            hits += spheres[i % spheres.size()]->hit(rays_float[i % rays.size()], 0.001f, (float) infinity, rec);
+        sink = hits;
+    });
+
+    run("moving_sphere_hit", n_tests, [&]() {
+        hit_record rec;
+        int hits = 0;
+        for (int i = 0; i < n_tests; i++)
+            hits += moving_spheres[i % moving_spheres.size()]->hit(rays[i % rays.size()], 0.001, infinity, rec);
+        sink = hits;
+    });
+
+    run("aabb_hit", n_tests, [&]() {
+        int hits = 0;
+        for (int i = 0; i < n_tests; i++)
+            hits += boxes[i % boxes.size()].hit(rays[i % rays.size()], 0.001, infinity);
+        sink = hits;
+    });
+
+    run("aabb_hit_float", n_tests, [&]() {
+        int hits = 0;
+        for (int i = 0; i < n_tests; i++)
+            hits += boxes[i % boxes.size()].hit(rays_float[i % rays.size()], 0.001f, (float) infinity);
+        sink = hits;
+    });
+
+    // Every object of the scene against each ray, no acceleration structure
+    const int n_list_rays = 20000;
+    run("hittable_list_hit", n_list_rays, [&]() {
+        hit_record rec;
+        int hits = 0;
+        for (int i = 0; i < n_list_rays; i++)
+            hits += world.hit(rays[i], 0.001, infinity, rec);
+        sink = hits;
+    });
+
+    // Same objects as tagged values in a primitive_array, switch dispatch
+    primitive_array closed;
+    for (auto & object : world.objects)
+        closed.add(object);
+    run("closed_list_hit", n_list_rays, [&]() {
+        hit_record rec;
+        int hits = 0;
+        for (int i = 0; i < n_list_rays; i++)
+            hits += closed.hit_range(rays[i], 0, closed.size(), 0.001, infinity, rec);
+        sink = hits;
+    });
+
+    // Closest hits through the hierarchies over the same objects, counted in
+    // node tests (one slab test per node visited, from the ray statistics)
+    bvh_node tree(world, 0.0, 1.0);
+    linear_bvh flat(world, 0.0, 1.0);
+    for (auto h : { std::make_pair("bvh_node_tests", (const hittable*) &tree),
+                    std::make_pair("linear_bvh_node_tests", (const hittable*) &flat) }) {
+        const hittable* bvh = h.second;
+        auto traverse = [&]() {
+            hit_record rec;
+            int hits = 0;
+            for (auto & r : rays)
+                hits += bvh->hit(r, 0.001, infinity, rec);
+            sink = hits;
+        };
+        thread_ray_stats().reset();
+        traverse();
+        double tests = RT_STATS_ENABLED ? (double) thread_ray_stats().node_visits : (double) rays.size();
+        run(h.first, tests, traverse);
+    }
+
+    camera cam(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20.0, 1.5, 0.1, 10.0, 0.0, 1.0);
+    run("camera_get_ray", n_tests, [&]() {
+        double acc = 0;
+        for (int i = 0; i < n_tests; i++) {
+            ray r = cam.get_ray((i % 1000) / 999.0, (i / 1000 % 1000) / 999.0);
+            acc += r.direction().x();
+        }
+        sink = acc;
+    });
+
+    run("camera_get_ray_float", n_tests, [&]() {
+        float acc = 0;
+        for (int i = 0; i < n_tests; i++) {
+            rayf r = cam.get_ray((i % 1000) / 999.0f, (i / 1000 % 1000) / 999.0f);
+            acc += r.direction().x();
+        }
+        sink = acc;
+    });
+
+    // Scattering of each material at hit points of a unit sphere
+    auto hits = sphere_hits(100000);
+    lambertian diffuse(color(0.5, 0.5, 0.5));
+    metal shiny(color(0.7, 0.6, 0.5), 0.1);
+    dielectric glass(1.5);
+    for (auto m : { std::make_pair("lambertian_scatter", (const material*) &diffuse),
+                    std::make_pair("metal_scatter", (const material*) &shiny),
+                    std::make_pair("dielectric_scatter", (const material*) &glass) }) {
+        const material* mat = m.second;
+        run(m.first, n_tests, [&]() {
+            color attenuation;
+            ray scattered;
+            double acc = 0;
+            for (int i = 0; i < n_tests; i++) {
+                const auto& h = hits[i % hits.size()];
+                if (mat->scatter(h.first, h.second, attenuation, scattered))
+                    acc += scattered.direction().x();
+            }
+            sink = acc;
+        });
+        run(std::string(m.first) + "_closed", n_tests, [&]() {
+            color attenuation;
+            ray scattered;
+            double acc = 0;
+            for (int i = 0; i < n_tests; i++) {
+                const auto& h = hits[i % hits.size()];
+                if (scatter_material(*mat, h.first, h.second, attenuation, scattered))
+                    acc += scattered.direction().x();
+            }
+            sink = acc;
+        });
+    }
+
+    // Bvh builds over the random scene on larger and larger grids
+    for (int extent : build_extents) {
+        seed_thread_rng(2022, 0);
+        hittable_list scene = random_scene(extent);
+        for (auto builder : { bvh_builder::sah, bvh_builder::lbvh }) {
+            double sah_cost = 0;
+            run(std::string(bvh_builder_name(builder)) + "_build_" + std::to_string(scene.objects.size()),
+                scene.objects.size(), [&]() {
+                    linear_bvh accel(scene, 0.0, 1.0, builder);
+                    sah_cost = accel.sah_cost();
+                });
+            results.back().sah_cost = sah_cost;
+        }
+    }
+
+    // Full frames at a fixed seed, counted in camera rays (samples)
+    for (auto scene : { "RandomWorld.xml", "RandomWorld2.xml" }) {
+        std::string path = data_dir + "/" + scene;
+        Engine engine(path.c_str());
+        engine.setSeed(2022);
+        engine.setSamplesPerPixel(spp);
+        double samples = (double) engine.getImgWidth() * engine.getImgHeight() * spp;
+        run(std::string("render_") + scene, samples, [&]() {
+            engine.setToWork();
+            engine.createImage();
+        });
+        engine.setPrimaryPackets(true);
+        run(std::string("render_packets_") + scene, samples, [&]() {
+            engine.setToWork();
+            engine.createImage();
+        });
+        engine.setPrimaryPackets(false);
+        engine.setIntegrator(render_integrator::wavefront);
+        run(std::string("render_wavefront_") + scene, samples, [&]() {
+            engine.setToWork();
+            engine.createImage();
+        });
+    }
+
+    FILE* out = stdout;
+    if (!out_file.empty()) {
+        out = fopen(out_file.c_str(), "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Could not write %s\n", out_file.c_str());
+            return 1;
+        }
+    }
+
+    if (json) {
+        fprintf(out, "{\n  \"threads\": %d,\n  \"spp\": %d,\n  \"repeats\": %d,\n  \"results\": [\n",
+                omp_get_max_threads(), spp, repeats);
+        for (size_t i = 0; i < results.size(); i++) {
+            const bench_result& r = results[i];
+            fprintf(out, "    {\"benchmark\": \"%s\", \"rays\": %.0f, \"seconds\": %.6f, "
+                         "\"rays_per_second\": %.1f, \"ns_per_ray\": %.3f",
+                    r.name.c_str(), r.rays, r.seconds, r.rays / r.seconds, r.seconds / r.rays * 1e9);
+            if (r.sah_cost > 0) fprintf(out, ", \"sah_cost\": %.6f", r.sah_cost);
+            fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+    }
+    else {
+        fprintf(out, "benchmark,rays,seconds,rays_per_second,ns_per_ray,sah_cost\n");
+        for (auto & r : results) {
+            fprintf(out, "%s,%.0f,%.6f,%.1f,%.3f,",
+                    r.name.c_str(), r.rays, r.seconds, r.rays / r.seconds, r.seconds / r.rays * 1e9);
+            if (r.sah_cost > 0) fprintf(out, "%.6f", r.sah_cost);
+            fprintf(out, "\n");
+        }
+    }
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Image difference between the float and double renders of the example
+// scenes, at the same seed and samples per pixel. Paths drift apart after a
+// few rounded bounces, so the difference is set against the noise of the
+// renderer: noise_psnr compares two double renders with different seeds,
+// a float render well above it cannot be told from a double one. mean_diff
+// is the average float - double value of the channels, a bias shows there.
+//
+//   precision_bench [--json] [--data=dir] [--spp=N] [--diff-dir=dir]
+//
+// --diff-dir saves |float - double| of each scene amplified 8 times as PNG.
+// Other arguments of make bench are ignored.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+
+struct image_difference {
+    double mse;
+    double psnr;      // 99 for identical images
+    int max_diff;     // largest channel difference
+    double mean_diff; // average of b - a over the channels
+};
+
+// Over the rgb channels, alpha is always opaque
+image_difference compare_images(const std::vector<sf::Uint8>& a, const std::vector<sf::Uint8>& b) {
+    image_difference d = { 0, 99, 0, 0 };
+    size_t n = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (i % 4 == 3) continue;
+        int delta = (int) b[i] - (int) a[i];
+        d.mse += delta * delta;
+        d.mean_diff += delta;
+        d.max_diff = std::max(d.max_diff, std::abs(delta));
+        n++;
+    }
+    d.mse /= n;
+    d.mean_diff /= n;
+    if (d.mse > 0) d.psnr = 10 * log10(255.0 * 255.0 / d.mse);
+    return d;
+}
+
+struct precision_result {
+    std::string scene;
+    double double_seconds, float_seconds;
+    image_difference float_vs_double;
+    image_difference noise; // double against double at another seed
+};
+
+// Render of the engine at a seed and precision, returns the seconds it took
+double render(Engine& engine, uint64_t seed, render_precision precision) {
+    engine.setSeed(seed);
+    engine.setPrecision(precision);
+    auto start = std::chrono::steady_clock::now();
+    engine.setToWork();
+    engine.createImage();
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    std::string data_dir = "data", diff_dir;
+    int spp = 8;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) json = true;
+        else if (strncmp(argv[i], "--data=", 7) == 0) data_dir = argv[i]+7;
+        else if (strncmp(argv[i], "--spp=", 6) == 0) spp = atoi(argv[i]+6);
+        else if (strncmp(argv[i], "--diff-dir=", 11) == 0) diff_dir = argv[i]+11;
+    }
+    if (spp < 1) spp = 1;
+
+    const uint64_t seed = 2022;
+    std::vector<precision_result> results;
+
+    for (auto scene : { "RandomWorld.xml", "RandomWorld2.xml" }) {
+        std::string path = data_dir + "/" + scene;
+        Engine engine(path.c_str());
+        engine.setSamplesPerPixel(spp);
+
+        precision_result r;
+        r.scene = scene;
+        r.double_seconds = render(engine, seed, render_precision::float64);
+        std::vector<sf::Uint8> reference = engine.getPixels();
+
+        r.float_seconds = render(engine, seed, render_precision::float32);
+        std::vector<sf::Uint8> single = engine.getPixels();
+        r.float_vs_double = compare_images(reference, single);
+
+        render(engine, seed + 1, render_precision::float64);
+        r.noise = compare_images(reference, engine.getPixels());
+
+        if (!diff_dir.empty()) {
+            std::vector<sf::Uint8> diff(reference.size(), 255);
+            for (size_t i = 0; i < diff.size(); i++)
+                if (i % 4 != 3) diff[i] = (sf::Uint8) std::min(255, 8 * std::abs((int) single[i] - (int) reference[i]));
+            sf::Image image;
+            image.create(engine.getImgWidth(), engine.getImgHeight(), diff.data());
+            std::string out = diff_dir + "/" + std::string(scene).substr(0, strlen(scene) - 4) + "_float_diff.png";
+            if (!image.saveToFile(out)) fprintf(stderr, "Could not write %s\n", out.c_str());
+        }
+
+        results.push_back(r);
+    }
+
+    if (json) {
+        printf("{\n  \"threads\": %d,\n  \"spp\": %d,\n  \"results\": [\n", omp_get_max_threads(), spp);
+        for (size_t i = 0; i < results.size(); i++) {
+            const precision_result& r = results[i];
+            printf("    {\"scene\": \"%s\", \"double_seconds\": %.6f, \"float_seconds\": %.6f, "
+                   "\"speedup\": %.3f, \"mse\": %.4f, \"psnr\": %.2f, \"max_diff\": %d, "
+                   "\"mean_diff\": %.4f, \"noise_psnr\": %.2f}%s\n",
+                   r.scene.c_str(), r.double_seconds, r.float_seconds, r.double_seconds / r.float_seconds,
+                   r.float_vs_double.mse, r.float_vs_double.psnr, r.float_vs_double.max_diff,
+                   r.float_vs_double.mean_diff, r.noise.psnr, i + 1 < results.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+    }
+    else {
+        printf("scene,spp,double_seconds,float_seconds,speedup,mse,psnr,max_diff,mean_diff,noise_psnr\n");
+        for (auto & r : results)
+            printf("%s,%d,%.6f,%.6f,%.3f,%.4f,%.2f,%d,%.4f,%.2f\n",
+                   r.scene.c_str(), spp, r.double_seconds, r.float_seconds, r.double_seconds / r.float_seconds,
+                   r.float_vs_double.mse, r.float_vs_double.psnr, r.float_vs_double.max_diff,
+                   r.float_vs_double.mean_diff, r.noise.psnr);
+    }
+
+    return 0;
+}
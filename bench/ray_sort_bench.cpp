@@ -0,0 +1,135 @@
+// Locality of the secondary rays of the wavefront integrator with and without
+// the ray sort, on data/RandomWorld.xml and on the same camera over
+// random_scene scaled up (--extents, half sides of the grid), whose hierarchy
+// no longer fits in the 32 KiB of node_cache_model. The counters come from
+// the ray statistics: node visits do not depend on the ray order, the node
+// cache misses per ray do. psnr compares the two images, the sort only
+// reorders the paths. A wave holds the samples of a tile, larger tiles give
+// the sort more rays to group.
+//
+//   ray_sort_bench [--json] [--data=dir] [--spp=N] [--tile-size=N]
+//                  [--extents=50,160]
+//
+// Other arguments of make bench are ignored.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+
+struct sort_run {
+    double seconds;
+    ray_stats stats;
+};
+
+struct ray_sort_result {
+    std::string scene;
+    sort_run unsorted, sorted;
+    double psnr; // sorted against unsorted image, 99 when identical
+};
+
+sort_run render(Engine& engine, bool ray_sort) {
+    engine.setRaySort(ray_sort);
+    auto start = std::chrono::steady_clock::now();
+    engine.setToWork();
+    engine.createImage();
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return { d.count(), engine.getRayStats() };
+}
+
+double image_psnr(const std::vector<sf::Uint8>& a, const std::vector<sf::Uint8>& b) {
+    double mse = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (i % 4 == 3) continue;
+        double delta = (double) b[i] - (double) a[i];
+        mse += delta * delta;
+        n++;
+    }
+    mse /= n;
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99;
+}
+
+double per_ray(uint64_t count, const ray_stats& stats) {
+    return stats.rays() ? (double) count / stats.rays() : 0.0;
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    std::string data_dir = "data";
+    int spp = 4, tile_size = 0;
+    std::vector<int> extents = { 50, 160 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) json = true;
+        else if (strncmp(argv[i], "--data=", 7) == 0) data_dir = argv[i]+7;
+        else if (strncmp(argv[i], "--spp=", 6) == 0) spp = atoi(argv[i]+6);
+        else if (strncmp(argv[i], "--tile-size=", 12) == 0) tile_size = atoi(argv[i]+12);
+        else if (strncmp(argv[i], "--extents=", 10) == 0) {
+            extents.clear();
+            for (const char* p = argv[i]+10; *p; p++) {
+                if (atoi(p) > 0) extents.push_back(atoi(p));
+                while (*p && *p != ',') p++;
+                if (!*p) break;
+            }
+        }
+    }
+    if (spp < 1) spp = 1;
+    if (!RT_STATS_ENABLED) fprintf(stderr, "Built without ray statistics, the counters are 0\n");
+
+    std::string path = data_dir + "/RandomWorld.xml";
+    Engine engine(path.c_str());
+    engine.setSeed(2022);
+    engine.setSamplesPerPixel(spp);
+    engine.setIntegrator(render_integrator::wavefront);
+    if (tile_size > 0) engine.setTileSize(tile_size);
+
+    std::vector<ray_sort_result> results;
+    for (size_t s = 0; s <= extents.size(); s++) {
+        ray_sort_result r;
+        if (s == 0) r.scene = "RandomWorld.xml";
+        else {
+            r.scene = "random_scene_" + std::to_string(extents[s - 1]);
+            engine.getWorld() = random_scene(extents[s - 1]);
+            engine.buildAccelerator();
+        }
+
+        r.unsorted = render(engine, false);
+        std::vector<sf::Uint8> reference = engine.getPixels();
+        r.sorted = render(engine, true);
+        r.psnr = image_psnr(reference, engine.getPixels());
+        results.push_back(r);
+    }
+
+    if (json) {
+        printf("{\n  \"threads\": %d,\n  \"spp\": %d,\n  \"results\": [\n", omp_get_max_threads(), spp);
+        for (size_t i = 0; i < results.size(); i++) {
+            const ray_sort_result& r = results[i];
+            printf("    {\"scene\": \"%s\", \"unsorted_seconds\": %.6f, \"sorted_seconds\": %.6f, "
+                   "\"node_visits_per_ray\": %.3f, \"unsorted_misses_per_ray\": %.4f, "
+                   "\"sorted_misses_per_ray\": %.4f, \"psnr\": %.2f}%s\n",
+                   r.scene.c_str(), r.unsorted.seconds, r.sorted.seconds,
+                   per_ray(r.unsorted.stats.node_visits, r.unsorted.stats),
+                   per_ray(r.unsorted.stats.node_cache_misses, r.unsorted.stats),
+                   per_ray(r.sorted.stats.node_cache_misses, r.sorted.stats),
+                   r.psnr, i + 1 < results.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+    }
+    else {
+        printf("scene,spp,unsorted_seconds,sorted_seconds,node_visits_per_ray,"
+               "unsorted_misses_per_ray,sorted_misses_per_ray,psnr\n");
+        for (auto & r : results)
+            printf("%s,%d,%.6f,%.6f,%.3f,%.4f,%.4f,%.2f\n",
+                   r.scene.c_str(), spp, r.unsorted.seconds, r.sorted.seconds,
+                   per_ray(r.unsorted.stats.node_visits, r.unsorted.stats),
+                   per_ray(r.unsorted.stats.node_cache_misses, r.unsorted.stats),
+                   per_ray(r.sorted.stats.node_cache_misses, r.sorted.stats), r.psnr);
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Microbenchmark of sphere_set against the virtual sphere::hit /
+// moving_sphere::hit calls of hittable_list, on the spheres of random_scene.
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "hittable_list.hpp"
+#include "sphere_set.hpp"
+
+template <typename F>
+double seconds(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+int main() {
+    seed_thread_rng(2022, 0);
+    hittable_list world = random_scene();
+
+    sphere_set spheres;
+    for (auto & object : world.objects)
+        spheres.add(object);
+
+    // Rays shot from around the camera of the example scenes into the scene
+    const int n_rays = 20000;
+    std::vector<ray> rays;
+    for (int i = 0; i < n_rays; i++) {
+        point3 origin(13 + random_double(-1, 1), 2 + random_double(-1, 1), 3 + random_double(-1, 1));
+        point3 target(random_double(-11, 11), random_double(0, 1), random_double(-11, 11));
+        rays.push_back(ray(origin, target - origin, random_double()));
+    }
+
+    // Groups of 8 spheres, the size of a bvh leaf
+    const size_t group = 8;
+    size_t n_groups = world.objects.size() / group;
+    double tests = (double) n_rays * n_groups * group;
+    int hits = 0;
+
+    printf("spheres: %zu, rays: %d, group size: %zu\n", world.objects.size(), n_rays, group);
+
+    double t_virtual = seconds([&]() {
+        for (auto & r : rays) {
+            for (size_t g = 0; g < n_groups; g++) {
+                hit_record rec;
+                auto closest = infinity;
+                bool hit_anything = false;
+                for (size_t i = g * group; i < (g + 1) * group; i++) {
+                    if (world.objects[i]->hit(r, 0.001, closest, rec)) {
+                        closest = rec.t;
+                        hit_anything = true;
+                    }
+                }
+                if (hit_anything) hits++;
+            }
+        }
+    });
+    printf("%-18s %8.2f ns/sphere %8.1f M sphere tests/s (%d hits)\n",
+           "virtual hit", t_virtual / tests * 1e9, tests / t_virtual / 1e6, hits);
+
+    for (auto level : {simd_level::scalar, simd_level::sse, simd_level::avx2}) {
+        if (level > detect_simd_level()) continue;
+        sphere_set_simd_level() = level;
+        hits = 0;
+        double t = seconds([&]() {
+            for (auto & r : rays) {
+                for (size_t g = 0; g < n_groups; g++) {
+                    hit_record rec;
+                    if (spheres.hit_range(r, g * group, group, 0.001, infinity, rec))
+                        hits++;
+                }
+            }
+        });
+        printf("sphere_set %-7s %8.2f ns/sphere %8.1f M sphere tests/s (%d hits, x%.2f)\n",
+               simd_level_name(level), t / tests * 1e9, tests / t / 1e6, hits, t_virtual / t);
+    }
+
+    return 0;
+}
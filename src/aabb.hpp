@@ -3,6 +3,14 @@
 
 #include "rt.hpp"
 
+// 1 + 2 gamma(3), gamma(n) = n eps / (1 - n eps) bounding the relative error
+// of n rounded operations
+template <typename T>
+inline T slab_far_scale() {
+    const T gamma3 = 3 * std::numeric_limits<T>::epsilon() / (1 - 3 * std::numeric_limits<T>::epsilon());
+    return 1 + 2 * gamma3;
+}
+
 class aabb {
     public:
         aabb() {}
@@ -11,34 +19,33 @@ class aabb {
         point3 min() const {return minimum; }
         point3 max() const {return maximum; }
 
-        //~ bool hit(const ray& r, double t_min, double t_max) const {
-            //~ for (int a = 0; a < 3; a++) {
-                //~ auto t0 = fmin((minimum[a] - r.origin()[a]) / r.direction()[a],
-                               //~ (maximum[a] - r.origin()[a]) / r.direction()[a]);
-                //~ auto t1 = fmax((minimum[a] - r.origin()[a]) / r.direction()[a],
-                               //~ (maximum[a] - r.origin()[a]) / r.direction()[a]);
-                //~ t_min = fmax(t0, t_min);
-                //~ t_max = fmin(t1, t_max);
-                //~ if (t_max <= t_min)
-                    //~ return false;
-            //~ }
-            //~ return true;
-        //~ }
-        
-        bool hit(const ray& r, double t_min, double t_max) const {
-			for (int a = 0; a < 3; a++) {
-				auto invD = 1.0f / r.direction()[a];
-				auto t0 = (min()[a] - r.origin()[a]) * invD;
-				auto t1 = (max()[a] - r.origin()[a]) * invD;
-				if (invD < 0.0f)
-					std::swap(t0, t1);
-				t_min = t0 > t_min ? t0 : t_min;
-				t_max = t1 < t_max ? t1 : t_max;
-				if (t_max <= t_min)
-					return false;
-			}
-			return true;
-		}
+        double surface_area() const {
+            auto d = maximum - minimum;
+            return 2.0 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
+        // Branchless slab test with the inverse direction of the ray: the
+        // near and far planes of each axis are picked by the signs of the
+        // direction instead of swapped. A ray parallel to a slab and lying on
+        // one of its planes gives 0 * inf = NaN, which the comparisons ignore
+        // so the box is kept. t_far is grown by the relative rounding error of
+        // its computation (3 operations, PBRT's gamma), so rounding never culls
+        // a box the ray touches. The box is kept in double, a float ray tests
+        // it in float.
+        template <typename T>
+        bool hit(const ray_t<T>& r, T t_min, T t_max) const {
+            const vec3_t<T>& inv = r.inv_direction();
+            const vec3_t<T> orig = r.origin();
+            for (int a = 0; a < 3; a++) {
+                const point3& near_side = r.dir_is_neg(a) ? maximum : minimum;
+                const point3& far_side = r.dir_is_neg(a) ? minimum : maximum;
+                T t_near = (static_cast<T>(near_side[a]) - orig[a]) * inv[a];
+                T t_far = (static_cast<T>(far_side[a]) - orig[a]) * inv[a] * slab_far_scale<T>();
+                t_min = t_near > t_min ? t_near : t_min;
+                t_max = t_far < t_max ? t_far : t_max;
+            }
+            return t_min <= t_max;
+        }
 
         point3 minimum;
         point3 maximum;
@@ -0,0 +1,558 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rt.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "ray_stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+#include <stdexcept>
+
+#include "../include/tinyxml2.h"
+
+// Object with its bounding box and centroid, computed once before a build.
+// box covers the whole interval, box0 and box1 are the boxes at its ends.
+struct bvh_build_entry {
+    shared_ptr<hittable> object;
+    aabb box;
+    aabb box0, box1;
+    point3 centroid;
+};
+
+inline std::vector<bvh_build_entry> bvh_build_entries(
+    const std::vector<shared_ptr<hittable>>& objects,
+    size_t start, size_t end, double time0, double time1) {
+
+    std::vector<bvh_build_entry> entries;
+    entries.reserve(end - start);
+
+    for (size_t i = start; i < end; i++) {
+        bvh_build_entry entry;
+        entry.object = objects[i];
+        if (!entry.object->bounding_box(time0, time1, entry.box)
+            || !entry.object->bounding_box(time0, time0, entry.box0)
+            || !entry.object->bounding_box(time1, time1, entry.box1))
+            throw std::invalid_argument("No bounding box in bvh constructor");
+        entry.centroid = 0.5 * (entry.box.min() + entry.box.max());
+        entries.push_back(entry);
+    }
+
+    return entries;
+}
+
+// True when some object is not at the same place at both ends of the interval
+inline bool bvh_entries_move(const std::vector<bvh_build_entry>& entries) {
+    for (auto & entry : entries)
+        for (int a = 0; a < 3; a++)
+            if (entry.box0.min()[a] != entry.box1.min()[a] || entry.box0.max()[a] != entry.box1.max()[a])
+                return true;
+    return false;
+}
+
+// Surface area heuristic: sweeps every axis, sorting entries[start,end) by
+// centroid and accumulating the areas of the boxes from both sides, and keeps
+// the split minimizing area(left) * n_left + area(right) * n_right.
+// The entries are left sorted along the chosen axis, split is the size of the
+// left group and the returned value is the (unnormalized) cost of that split.
+inline double sah_split(
+    std::vector<bvh_build_entry>& entries, size_t start, size_t end, int& axis_out, size_t& split) {
+    size_t object_span = end - start;
+    std::vector<double> right_area(object_span);
+    double best_cost = infinity;
+    int best_axis = -1;
+    split = object_span / 2;
+
+    for (int axis = 0; axis < 3; axis++) {
+        std::sort(entries.begin() + start, entries.begin() + end,
+            [axis](const bvh_build_entry& a, const bvh_build_entry& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+
+        // All centroids on the same plane, splitting along this axis is arbitrary
+        if (entries[start].centroid[axis] == entries[end-1].centroid[axis])
+            continue;
+
+        aabb acc = entries[end-1].box;
+        for (size_t i = object_span - 1; i > 0; i--) {
+            acc = surrounding_box(acc, entries[start+i].box);
+            right_area[i] = acc.surface_area();
+        }
+
+        acc = entries[start].box;
+        for (size_t i = 1; i < object_span; i++) {
+            double cost = acc.surface_area() * i + right_area[i] * (object_span - i);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                split = i;
+            }
+            acc = surrounding_box(acc, entries[start+i].box);
+        }
+    }
+
+    axis_out = best_axis == -1 ? 0 : best_axis;
+
+    if (best_axis == -1) {
+        // Every centroid is the same point: cut the range in two halves
+        aabb box = entries[start].box;
+        for (size_t i = start + 1; i < end; i++)
+            box = surrounding_box(box, entries[i].box);
+        return box.surface_area() * object_span;
+    }
+
+    if (best_axis != 2) {
+        std::sort(entries.begin() + start, entries.begin() + end,
+            [best_axis](const bvh_build_entry& a, const bvh_build_entry& b) {
+                return a.centroid[best_axis] < b.centroid[best_axis];
+            });
+    }
+
+    return best_cost;
+}
+
+// Extend box to enclose other, surrounding_box in place for the build loops
+inline void grow(aabb& box, const aabb& other) {
+    for (int a = 0; a < 3; a++) {
+        if (other.minimum[a] < box.minimum[a]) box.minimum[a] = other.minimum[a];
+        if (other.maximum[a] > box.maximum[a]) box.maximum[a] = other.maximum[a];
+    }
+}
+
+// Bounds of a range of entries: boxes over the interval and at both of its
+// ends, and box of the centroids
+struct bvh_range_bounds {
+    aabb box, box0, box1, centroids;
+
+    bvh_range_bounds() {
+        // Empty boxes, any box added replaces them
+        aabb empty(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+        box = box0 = box1 = centroids = empty;
+    }
+
+    void add(const bvh_build_entry& entry) {
+        grow(box, entry.box);
+        grow(box0, entry.box0);
+        grow(box1, entry.box1);
+        grow(centroids, aabb(entry.centroid, entry.centroid));
+    }
+
+    void merge(const bvh_range_bounds& other) {
+        grow(box, other.box);
+        grow(box0, other.box0);
+        grow(box1, other.box1);
+        grow(centroids, other.centroids);
+    }
+};
+
+// Ranges of entries at least that long are processed by bvh_parallel_chunks
+// tasks when the build runs in an OpenMP parallel region
+static const size_t bvh_parallel_range = 1 << 15;
+static const int bvh_parallel_chunks = 16;
+
+// Call f(chunk, chunk_start, chunk_end) over n_chunks slices of [start, end),
+// each one an OpenMP task (run at once outside of a parallel region)
+template <typename F>
+void bvh_for_chunks(size_t start, size_t end, int n_chunks, F f) {
+    for (int c = 0; c < n_chunks; c++) {
+        size_t chunk_start = start + (end - start) * c / n_chunks;
+        size_t chunk_end = start + (end - start) * (c + 1) / n_chunks;
+        #pragma omp task default(shared) firstprivate(c, chunk_start, chunk_end)
+        f(c, chunk_start, chunk_end);
+    }
+    #pragma omp taskwait
+}
+
+inline bvh_range_bounds bvh_bounds(const std::vector<bvh_build_entry>& entries, size_t start, size_t end) {
+    int n_chunks = end - start >= bvh_parallel_range ? bvh_parallel_chunks : 1;
+    std::vector<bvh_range_bounds> partial(n_chunks);
+    bvh_for_chunks(start, end, n_chunks, [&](int c, size_t chunk_start, size_t chunk_end) {
+        for (size_t i = chunk_start; i < chunk_end; i++)
+            partial[c].add(entries[i]);
+    });
+
+    bvh_range_bounds bounds;
+    for (auto & p : partial) bounds.merge(p);
+    return bounds;
+}
+
+static const int sah_bins = 32;
+
+struct sah_bin {
+    aabb box;
+    size_t count;
+};
+
+// Binned surface area heuristic: the centroids are sorted into sah_bins slabs
+// of their bounds along each axis and the split is only searched between
+// slabs, in linear time instead of the sorts of sah_split. Same contract as
+// sah_split, except that the entries are only partitioned around the split.
+// Large ranges are binned in parallel chunks.
+inline double binned_sah_split(
+    std::vector<bvh_build_entry>& entries, size_t start, size_t end,
+    const aabb& centroids, int& axis_out, size_t& split) {
+
+    size_t object_span = end - start;
+    auto extent = centroids.max() - centroids.min();
+    double scale[3];
+    for (int a = 0; a < 3; a++)
+        scale[a] = extent[a] > 0 ? sah_bins / extent[a] : 0;
+
+    auto bin_of = [&](const bvh_build_entry& entry, int axis) {
+        int b = static_cast<int>((entry.centroid[axis] - centroids.min()[axis]) * scale[axis]);
+        return b < 0 ? 0 : (b >= sah_bins ? sah_bins - 1 : b);
+    };
+
+    // Bins of the three axes, per chunk
+    typedef std::array<std::array<sah_bin, sah_bins>, 3> axis_bins;
+    aabb empty(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+    axis_bins init;
+    for (auto & bins : init)
+        for (auto & bin : bins) bin = { empty, 0 };
+
+    int n_chunks = object_span >= bvh_parallel_range ? bvh_parallel_chunks : 1;
+    std::vector<axis_bins> partial(n_chunks, init);
+    bvh_for_chunks(start, end, n_chunks, [&](int c, size_t chunk_start, size_t chunk_end) {
+        axis_bins& bins = partial[c];
+        for (size_t i = chunk_start; i < chunk_end; i++) {
+            for (int a = 0; a < 3; a++) {
+                sah_bin& bin = bins[a][bin_of(entries[i], a)];
+                grow(bin.box, entries[i].box);
+                bin.count++;
+            }
+        }
+    });
+    axis_bins bins = partial[0];
+    for (int c = 1; c < n_chunks; c++)
+        for (int a = 0; a < 3; a++)
+            for (int b = 0; b < sah_bins; b++) {
+                grow(bins[a][b].box, partial[c][a][b].box);
+                bins[a][b].count += partial[c][a][b].count;
+            }
+
+    double best_cost = infinity;
+    int best_axis = -1, best_bin = 0;
+    for (int a = 0; a < 3; a++) {
+        if (scale[a] == 0) continue;
+
+        // right_area[b], right_count[b]: bins b and above
+        double right_area[sah_bins];
+        size_t right_count[sah_bins];
+        aabb acc = empty;
+        size_t count = 0;
+        for (int b = sah_bins - 1; b > 0; b--) {
+            grow(acc, bins[a][b].box);
+            count += bins[a][b].count;
+            right_area[b] = acc.surface_area();
+            right_count[b] = count;
+        }
+
+        acc = empty;
+        count = 0;
+        for (int b = 1; b < sah_bins; b++) {
+            grow(acc, bins[a][b-1].box);
+            count += bins[a][b-1].count;
+            if (count == 0 || right_count[b] == 0) continue;
+            double cost = acc.surface_area() * count + right_area[b] * right_count[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+
+    if (best_axis == -1) {
+        // Every centroid in the same bin: cut the range in two halves
+        axis_out = 0;
+        split = object_span / 2;
+        aabb box = empty;
+        for (int b = 0; b < sah_bins; b++)
+            grow(box, bins[0][b].box);
+        return box.surface_area() * object_span;
+    }
+
+    axis_out = best_axis;
+    auto middle = std::partition(entries.begin() + start, entries.begin() + end,
+        [&](const bvh_build_entry& entry) { return bin_of(entry, best_axis) < best_bin; });
+    split = static_cast<size_t>(middle - (entries.begin() + start));
+    return best_cost;
+}
+
+// Spread the low bits of x two bits apart: bit i moves to bit 3i
+inline uint64_t morton_spread(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+// Morton code of p quantized to bits per axis in bounds: x, y and z bits
+// interleaved from the highest, x first
+inline uint64_t morton_code(const point3& p, const aabb& bounds, int bits) {
+    uint64_t code = 0;
+    double cells = static_cast<double>((uint64_t(1) << bits) - 1);
+    for (int a = 0; a < 3; a++) {
+        double extent = bounds.max()[a] - bounds.min()[a];
+        double t = extent > 0 ? (p[a] - bounds.min()[a]) / extent : 0.0;
+        uint64_t cell = static_cast<uint64_t>(fmin(fmax(t, 0.0), 1.0) * cells);
+        code |= morton_spread(cell) << (2 - a);
+    }
+    return code;
+}
+
+// Axis of a bit of a Morton code
+inline int morton_axis(int bit) { return 2 - bit % 3; }
+
+struct bvh_morton_item {
+    uint64_t code;
+    uint32_t index;
+};
+
+// Stable LSD radix sort on the low key_bits of the codes, 8 bits per pass.
+// Every pass counts the digits of one chunk per thread, then each thread
+// scatters its chunk from its own offsets.
+inline void bvh_radix_sort(std::vector<bvh_morton_item>& items, int key_bits) {
+    const size_t n = items.size();
+    const int passes = (key_bits + 7) / 8;
+    std::vector<bvh_morton_item> buffer(n);
+    std::vector<size_t> offsets;
+
+    #pragma omp parallel if (n >= bvh_parallel_range)
+    {
+        int threads = omp_get_num_threads(), t = omp_get_thread_num();
+        size_t chunk_start = n * t / threads, chunk_end = n * (t + 1) / threads;
+        #pragma omp single
+        offsets.resize(256 * threads);
+
+        bvh_morton_item* from = items.data();
+        bvh_morton_item* to = buffer.data();
+        for (int pass = 0; pass < passes; pass++) {
+            int shift = 8 * pass;
+            size_t* count = &offsets[256 * t];
+            std::fill(count, count + 256, 0);
+            for (size_t i = chunk_start; i < chunk_end; i++)
+                count[(from[i].code >> shift) & 255]++;
+            #pragma omp barrier
+
+            // Digits in order, and the chunks of a digit in thread order
+            #pragma omp single
+            {
+                size_t offset = 0;
+                for (int d = 0; d < 256; d++)
+                    for (int th = 0; th < threads; th++) {
+                        size_t c = offsets[256 * th + d];
+                        offsets[256 * th + d] = offset;
+                        offset += c;
+                    }
+            }
+
+            for (size_t i = chunk_start; i < chunk_end; i++)
+                to[count[(from[i].code >> shift) & 255]++] = from[i];
+            #pragma omp barrier
+            std::swap(from, to);
+        }
+    }
+
+    if (passes % 2 == 1) items.swap(buffer);
+}
+
+// Same sort by the calling thread alone, for callers already inside a
+// parallel region. buffer is scratch space the caller keeps from a sort to
+// the next, the two vectors may swap their storage.
+inline void bvh_radix_sort_serial(std::vector<bvh_morton_item>& items, int key_bits,
+                                  std::vector<bvh_morton_item>& buffer) {
+    const size_t n = items.size();
+    const int passes = (key_bits + 7) / 8;
+    buffer.resize(n);
+
+    bvh_morton_item* from = items.data();
+    bvh_morton_item* to = buffer.data();
+    for (int pass = 0; pass < passes; pass++) {
+        int shift = 8 * pass;
+        size_t count[256] = {};
+        for (size_t i = 0; i < n; i++)
+            count[(from[i].code >> shift) & 255]++;
+
+        size_t offset = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            to[count[(from[i].code >> shift) & 255]++] = from[i];
+        std::swap(from, to);
+    }
+
+    if (passes % 2 == 1) items.swap(buffer);
+}
+
+// Ranges of at least that many primitives get 63-bit Morton codes (21 bits per
+// axis) instead of 30-bit ones
+static const size_t morton_wide_range = 1 << 20;
+
+// Sort the entries along the Morton curve of their centroids and return
+// their codes in the new order
+inline std::vector<uint64_t> bvh_morton_sort(std::vector<bvh_build_entry>& entries) {
+    const size_t n = entries.size();
+    aabb centroids = bvh_bounds(entries, 0, n).centroids;
+    int bits = n >= morton_wide_range ? 21 : 10;
+
+    std::vector<bvh_morton_item> items(n);
+    #pragma omp parallel for if (n >= bvh_parallel_range)
+    for (size_t i = 0; i < n; i++)
+        items[i] = { morton_code(entries[i].centroid, centroids, bits), static_cast<uint32_t>(i) };
+
+    bvh_radix_sort(items, 3 * bits);
+
+    std::vector<bvh_build_entry> sorted(n);
+    std::vector<uint64_t> codes(n);
+    #pragma omp parallel for if (n >= bvh_parallel_range)
+    for (size_t i = 0; i < n; i++) {
+        sorted[i] = std::move(entries[items[i].index]);
+        codes[i] = items[i].code;
+    }
+    entries.swap(sorted);
+    return codes;
+}
+
+// Bounding volume hierarchy over the objects of a hittable_list, each node
+// splitting its objects with sah_split so rays only descend into the boxes
+// they actually cross.
+class bvh_node : public hittable {
+    public:
+        bvh_node() {}
+
+        bvh_node(const hittable_list& list, double time0, double time1)
+            : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
+        {}
+
+        bvh_node(
+            const std::vector<shared_ptr<hittable>>& src_objects,
+            size_t start, size_t end, double time0, double time1);
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool hit(
+            const rayf& r, float t_min, float t_max, hit_recordf& rec) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+        virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const override;
+
+    public:
+        shared_ptr<hittable> left;
+        shared_ptr<hittable> right;
+        aabb box;
+
+    private:
+        bvh_node(std::vector<bvh_build_entry>& entries, size_t start, size_t end);
+
+        template <typename T>
+        bool hit_kernel(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) const;
+
+        void build(std::vector<bvh_build_entry>& entries, size_t start, size_t end);
+
+        void append_xml(tinyxml2::XMLDocument& xmlDoc, tinyxml2::XMLElement* pElement) const;
+};
+
+bvh_node::bvh_node(
+    const std::vector<shared_ptr<hittable>>& src_objects,
+    size_t start, size_t end, double time0, double time1) {
+
+    if (end <= start) throw std::invalid_argument("Cannot build a bvh_node over an empty list");
+
+    auto entries = bvh_build_entries(src_objects, start, end, time0, time1);
+    build(entries, 0, entries.size());
+}
+
+bvh_node::bvh_node(std::vector<bvh_build_entry>& entries, size_t start, size_t end) {
+    build(entries, start, end);
+}
+
+void bvh_node::build(std::vector<bvh_build_entry>& entries, size_t start, size_t end) {
+    size_t object_span = end - start;
+
+    box = entries[start].box;
+    for (size_t i = start + 1; i < end; i++)
+        box = surrounding_box(box, entries[i].box);
+
+    if (object_span == 1) {
+        left = right = entries[start].object;
+        return;
+    }
+
+    if (object_span == 2) {
+        left = entries[start].object;
+        right = entries[start+1].object;
+        return;
+    }
+
+    int best_axis;
+    size_t best_split;
+    sah_split(entries, start, end, best_axis, best_split);
+
+    auto mid = start + best_split;
+    left = (mid - start == 1) ? entries[start].object
+                              : shared_ptr<hittable>(new bvh_node(entries, start, mid));
+    right = (end - mid == 1) ? entries[mid].object
+                             : shared_ptr<hittable>(new bvh_node(entries, mid, end));
+}
+
+bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    return hit_kernel(r, t_min, t_max, rec);
+}
+
+bool bvh_node::hit(const rayf& r, float t_min, float t_max, hit_recordf& rec) const {
+    return hit_kernel(r, t_min, t_max, rec);
+}
+
+template <typename T>
+bool bvh_node::hit_kernel(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) const {
+    RT_STAT(count_node_visit(this));
+    if (!box.hit(r, t_min, t_max))
+        return false;
+
+    bool hit_left = left->hit(r, t_min, t_max, rec);
+    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+
+    return hit_left || hit_right;
+}
+
+bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+tinyxml2::XMLElement* bvh_node::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+    // The hierarchy is rebuilt on load, only its objects are saved
+    tinyxml2::XMLElement * pElement = xmlDoc.NewElement("List");
+    append_xml(xmlDoc, pElement);
+    return pElement;
+}
+
+void bvh_node::append_xml(tinyxml2::XMLDocument& xmlDoc, tinyxml2::XMLElement* pElement) const {
+    for (auto & child : {left, right}) {
+        auto node = std::dynamic_pointer_cast<bvh_node>(child);
+        if (node != nullptr)
+            node->append_xml(xmlDoc, pElement);
+        else
+            pElement->InsertEndChild(child->to_xml(xmlDoc));
+
+        if (left == right) break;
+    }
+}
+
+#endif
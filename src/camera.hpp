@@ -87,17 +87,32 @@ class camera {
 
         }
 
-        ray get_ray(double s, double t) const {
-            vec3 rd = lens_radius * random_in_unit_disk();
-            vec3 offset = u * rd.x() + v * rd.y();
-
-            return ray(
-                origin + offset,
-                lower_left_corner + s*horizontal + t*vertical - origin - offset,
-                random_double(time0, time1)
+        // Ray in the precision of s and t, the camera frame is converted to it
+        template <typename T>
+        ray_t<T> get_ray(T s, T t) const {
+            const vec3_t<T> orig(origin), corner(lower_left_corner), hor(horizontal), vert(vertical);
+            vec3_t<T> rd = static_cast<T>(lens_radius) * random_in_unit_disk<T>();
+            vec3_t<T> offset = vec3_t<T>(u) * rd.x() + vec3_t<T>(v) * rd.y();
+
+            return ray_t<T>(
+                orig + offset,
+                corner + s*hor + t*vert - orig - offset,
+                static_cast<T>(random_double(time0, time1))
             );
         }
 
+        double shutter_open() const { return time0; }
+        double shutter_close() const { return time1; }
+
+        // Parameters the camera was built from
+        point3 look_from() const { return origin; }
+        point3 look_at() const { return lookat; }
+        vec3 view_up() const { return vup; }
+        double vertical_fov() const { return vfov; }
+        double aspect() const { return aspect_ratio; }
+        double lens_aperture() const { return aperture; }
+        double focus_distance() const { return focus_dist; }
+
         tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const {
             tinyxml2::XMLElement * pElement = xmlDoc.NewElement("Camera");
 
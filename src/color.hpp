@@ -27,4 +27,21 @@ void write_color(std::vector<sf::Uint8> &out, color pixel_color, int samples_per
     out[(lin * img_width + col) * 4 + 3] = static_cast<sf::Uint8>(255.9999);
 }
 
+// False color of t in [0, 1], from dark blue (cheap) through cyan, green and
+// yellow to red (expensive), in linear space like the colors of write_color
+inline color heat_color(double t) {
+    static const color stops[] = {
+        color(0.0, 0.0, 0.3), color(0.0, 0.6, 1.0), color(0.0, 0.8, 0.2),
+        color(1.0, 0.9, 0.0), color(1.0, 0.0, 0.0)
+    };
+    const int n_segments = 4;
+
+    t = clamp(t, 0.0, 1.0) * n_segments;
+    int k = t < n_segments ? static_cast<int>(t) : n_segments - 1;
+    double f = t - k;
+    color c = (1 - f) * stops[k] + f * stops[k + 1];
+    // write_color applies a gamma 2, the stops are given after it
+    return c * c;
+}
+
 #endif
@@ -4,21 +4,163 @@
 #include <omp.h>
 #include <vector>
 #include <chrono>
+#include <fstream>
+#include <algorithm>
 
 
 #ifndef ENGINE_HPP
 #define ENGINE_HPP
 
 #include "hittable_list.hpp"
+#include "linear_bvh.hpp"
 #include "color.hpp"
 #include "vec3.hpp"
 #include "ray.hpp"
 #include "rt.hpp"
 #include "camera.hpp"
 #include "material.hpp"
+#include "tile_scheduler.hpp"
+#include "scene_file.hpp"
+#include "ray_stats.hpp"
+
+// Russian roulette: once a path has bounced `depth` times (0 disables it) and
+// its throughput fell below `threshold`, it only continues with `probability`
+struct roulette_settings {
+    int depth = 0;
+    double probability = 0.8;
+    double threshold = 0.25;
+};
+
+// Adaptive sampling: pixels are sampled in rounds of `round` samples, from
+// min_spp up to the engine samples per pixel, and stop once the 95%
+// confidence interval of their luminance is below `error` times its mean
+struct adaptive_settings {
+    bool enabled = false;
+    int min_spp = 16;
+    int round = 8;
+    double error = 0.02;
+};
+
+// Cost of a pixel recorded for the heatmap of a frame
+enum class heatmap_metric {
+    none,
+    time,   // seconds spent on the pixel
+    tests   // primitive intersection tests and bvh node visits
+};
+
+// Scalar type of the rays, hit records and intersection kernels of a render.
+// float64 is the reference, float32 halves the size of the vectors and
+// traces the float bvh nodes without converting them; the scene itself stays
+// in double and is converted at the kernels.
+enum class render_precision { float64, float32 };
+
+inline const char* render_precision_name(render_precision precision) {
+    return precision == render_precision::float32 ? "float" : "double";
+}
+
+// False for an unknown name
+inline bool parse_render_precision(const char* name, render_precision& precision) {
+    if (strcmp(name, "double") == 0) precision = render_precision::float64;
+    else if (strcmp(name, "float") == 0) precision = render_precision::float32;
+    else return false;
+    return true;
+}
+
+// How the samples of a frame are traced. megakernel follows each path to its
+// end before starting the next one; wavefront advances all the paths of a
+// tile together, one bounce at a time, and scatters them grouped by material.
+enum class render_integrator { megakernel, wavefront };
+
+inline const char* render_integrator_name(render_integrator integrator) {
+    return integrator == render_integrator::wavefront ? "wavefront" : "megakernel";
+}
+
+// False for an unknown name
+inline bool parse_render_integrator(const char* name, render_integrator& integrator) {
+    if (strcmp(name, "megakernel") == 0) integrator = render_integrator::megakernel;
+    else if (strcmp(name, "wavefront") == 0) integrator = render_integrator::wavefront;
+    else return false;
+    return true;
+}
+
+// Path of the wavefront integrator between two bounces. Each path owns its
+// random generator, seeded like the samples of the progressive passes, so the
+// image does not depend on the order the paths are processed in.
+template <typename T>
+struct wavefront_path {
+    ray_t<T> r;
+    vec3_t<T> throughput;
+    pcg32 rng;
+    int pixel; // in the tile, row by row
+};
+
+// Paths of a wave at most, a tile with more samples is traced in several waves
+static const size_t wavefront_max_paths = 1 << 16;
+
+// Bits per axis of the origin cells the secondary rays are sorted by
+static const int ray_sort_cell_bits = 7;
+
+// Sort key of a secondary ray: the Morton code of the cell of its origin in
+// the bounds of the origins of the wave, then the octant of its direction
+template <typename T>
+inline uint64_t ray_sort_key(const ray_t<T>& r, const aabb& bounds) {
+    uint64_t octant = (r.direction().x() < 0) | (r.direction().y() < 0) << 1 | (r.direction().z() < 0) << 2;
+    return morton_code(point3(r.origin()), bounds, ray_sort_cell_bits) << 3 | octant;
+}
 
 class Engine {
     private:
+        // The hierarchy over the world, built if needed
+        const hittable& sceneToTrace();
+
+        // Color of one random sample of pixel (i, j)
+        color traceSample(int i, int j, const hittable& scene) const;
+
+        // Trace the samples of a pixel into pixel_color, returns their count
+        int samplePixel(int i, int j, const hittable& scene, color& pixel_color) const;
+
+        // Trace the samples of a tile with the wavefront integrator and write
+        // its pixels, returns the number of samples
+        template <typename T>
+        long long traceTileWavefront(const tile& tl, const hittable& scene);
+
+        // Trace the samples of a tile by 2x2 blocks of pixels, their camera
+        // rays intersected as a ray_packet, and write its pixels. Returns the
+        // number of samples.
+        template <typename T>
+        long long traceTilePackets(const tile& tl, const linear_bvh& bvh);
+
+        // Render path of createImage. The wavefront integrator and the
+        // packets only render frames with a fixed number of samples per
+        // pixel, without progressive passes nor heatmap.
+        bool usesWavefront() const {
+            return integrator == render_integrator::wavefront && !progressive && !adaptive.enabled
+                   && heatmap == heatmap_metric::none;
+        }
+
+        bool usesPrimaryPackets() const {
+            return primary_packets && !usesWavefront() && accel != nullptr && !progressive
+                   && !adaptive.enabled && heatmap == heatmap_metric::none;
+        }
+
+        int tileCount() const {
+            int ts = std::max(tile_size, 1);
+            return ((img_width + ts - 1) / ts) * ((img_height + ts - 1) / ts);
+        }
+
+        // Map a binary scene file and read the engine, camera and objects from it
+        void loadBinaryScene(const char* filename);
+
+        // Split the image in tiles rendered by all the threads,
+        // render_tile(tile) returns the number of samples it traced
+        template <typename TileFunction>
+        void renderTileGrid(TileFunction render_tile);
+
+        // Same, pixel by pixel: render_pixel(i, j, row) returns the number
+        // of samples it traced
+        template <typename PixelFunction>
+        void renderTiles(PixelFunction render_pixel);
+
         sf::Texture texture;
 
         int img_width;
@@ -28,13 +170,37 @@ class Engine {
         int samples_per_pixel;
         double aspect_ratio;
         int max_depth;
+        uint64_t seed = 0; // same seed -> same image, whatever the thread count
+        int tile_size = 16;
+        roulette_settings roulette;
+        adaptive_settings adaptive;
+        long long samples_taken = 0; // during the last frame
+        ray_stats frame_stats = {};  // of the last frame, merged from the threads
+        heatmap_metric heatmap = heatmap_metric::none;
+        std::vector<double> pixel_cost;  // heatmap of the last frame, rows from the top
+        double frame_seconds = 0;
+
+        /* progressive rendering: one sample per pixel per pass */
+        bool progressive = false;
+        bool stop_requested = false;
+        int passes_done = 0;
+        std::vector<float> accumulation; // sum of the passes, rgb per pixel
+        std::vector<tile_timing> tile_timings; // of the last frame
         hittable_list world;
+        shared_ptr<linear_bvh> accel; // bvh over world, rebuilt when the world changes
+        double refit_threshold = 1.1; // SAH degradation forcing a rebuild after a refit
+        bvh_builder builder = bvh_builder::sah;
+        render_precision precision = render_precision::float64;
+        render_integrator integrator = render_integrator::megakernel;
+        bool ray_sort = false;
+        bool primary_packets = false;
         camera cam;
         bool has_image=false;
         
         /* variables to enable progress bar */
         bool working = false;
-        int remaining_lines = 0;
+        int remaining_tiles = 0;
+        int total_tiles = 0;
         std::chrono::time_point<std::chrono::steady_clock> start_time;
 
     public:
@@ -50,10 +216,33 @@ class Engine {
         //        int samples_per_pixel = 50,
         //        int max_depth = 20);
 
-        Engine(const char* xml_filename);
+        // Load a scene saved by saveXmlDocument or saveBinaryScene
+        Engine(const char* filename);
 
         void saveXmlDocument(const char* filename) const;
 
+        // Same scene as saveXmlDocument in the memory-mappable format of scene_file.hpp
+        void saveBinaryScene(const char* filename) const;
+
+        // Build the bounding volume hierarchy used to trace the world
+        void buildAccelerator();
+
+        // Per-frame update, to call once objects of the world moved in place:
+        // the accelerator is refitted, and rebuilt once the SAH cost of its
+        // subtrees went over refit_threshold times their cost when built (see
+        // linear_bvh::sah_degradation). True when it was rebuilt.
+        bool updateScene();
+
+        void setRefitThreshold(double value) {
+            if (value < 1) throw std::invalid_argument("Refit threshold must be at least 1");
+            refit_threshold = value;
+        }
+
+        linear_bvh_stats acceleratorStats() {
+            if (accel == nullptr) buildAccelerator();
+            return accel ? accel->stats() : linear_bvh_stats();
+        }
+
         void createImage();
 
         void renderImage();
@@ -73,6 +262,138 @@ class Engine {
             max_depth = value;
         }
 
+        void setSeed(uint64_t value) {
+            seed = value;
+        }
+
+        void setTileSize(int value) {
+            tile_size = value;
+        }
+
+        void setRouletteDepth(int value) {
+            roulette.depth = value;
+        }
+
+        void setRouletteProbability(double value) {
+            roulette.probability = clamp(value, 0.01, 1.0);
+        }
+
+        void setRouletteThreshold(double value) {
+            roulette.threshold = value;
+        }
+
+        void setAdaptive(bool value) {
+            adaptive.enabled = value;
+        }
+
+        void setMinSamplesPerPixel(int value) {
+            adaptive.min_spp = value;
+        }
+
+        void setAdaptiveError(double value) {
+            adaptive.error = value;
+        }
+
+        void setProgressive(bool value) {
+            progressive = value;
+        }
+
+        bool isProgressive() { return progressive; }
+
+        // lbvh builds the accelerator faster but traces slower than sah
+        void setBvhBuilder(bvh_builder value) {
+            builder = value;
+            accel = nullptr;
+        }
+
+        bvh_builder getBvhBuilder() { return builder; }
+
+        // float32 traces faster, the images differ from the double ones by
+        // the rounding of the bounces (see bench/precision_bench.cpp)
+        void setPrecision(render_precision value) {
+            precision = value;
+        }
+
+        render_precision getPrecision() { return precision; }
+
+        // The wavefront integrator renders the frames with a fixed number of
+        // samples per pixel and no heatmap, the adaptive, progressive and
+        // heatmap renders stay on the megakernel. Its images are those of a
+        // progressive render with the same seed.
+        void setIntegrator(render_integrator value) {
+            integrator = value;
+        }
+
+        render_integrator getIntegrator() { return integrator; }
+
+        // Reorder the secondary rays of each wave of the wavefront integrator
+        // by direction octant and origin cell before intersecting them, so
+        // that consecutive rays traverse the same nodes. The image is the
+        // same, node_cache_misses in the ray statistics shows the effect on
+        // hierarchies larger than its 32 KiB model (see ray_sort_bench).
+        void setRaySort(bool value) {
+            ray_sort = value;
+        }
+
+        bool isRaySort() { return ray_sort; }
+
+        // Intersect the camera rays of the megakernel by packets of 2x2
+        // pixels. Each pixel keeps its random sequence, the image is the same.
+        // Adaptive and heatmap renders trace their pixels one by one.
+        void setPrimaryPackets(bool value) {
+            primary_packets = value;
+        }
+
+        bool isPrimaryPackets() { return primary_packets; }
+
+        // Settings that no render path uses with the others, one line each,
+        // empty when they all apply
+        std::string ignoredSettings();
+
+        // Progressive mode: the current pass is the last one
+        void stopWork() {
+            stop_requested = true;
+        }
+
+        int getPassesDone() { return passes_done; }
+
+        // Progressive mode: add one sample per pixel to the image, the
+        // render stops after samples_per_pixel passes or after stopWork()
+        void renderPass();
+
+        // Record the cost of each pixel during the next frames
+        void setHeatmap(heatmap_metric metric) {
+            if (metric == heatmap_metric::tests && !RT_STATS_ENABLED)
+                throw std::invalid_argument("A heatmap of intersection tests needs the ray statistics");
+            heatmap = metric;
+        }
+
+        // Cost mapped to red in the heatmap: the 99th percentile, so that a
+        // few extreme pixels do not flatten the rest of the image
+        double getHeatmapScale() const;
+
+        // False-color image of the pixel costs of the last frame
+        bool saveHeatmap(const char* filename) const;
+
+        // Rays traced during the last frame, zero when built with RT_NO_STATS
+        const ray_stats& getRayStats() const { return frame_stats; }
+
+        double getRenderSeconds() const { return frame_seconds; }
+
+        double getRaysPerSecond() const {
+            return frame_seconds > 0 ? frame_stats.rays() / frame_seconds : 0.0;
+        }
+
+        // Samples actually traced per pixel during the last frame
+        double getAverageSamplesPerPixel() {
+            return img_width * img_height > 0 ? (double) samples_taken / (img_width * img_height) : 0.0;
+        }
+
+        const std::vector<tile_timing>& getTileTimings() const { return tile_timings; }
+
+        // Write the per-tile timings of the last frame as CSV
+        void saveTileTimings(const char* filename) const;
+
         void setAspectRatio(double value) {
             aspect_ratio = value;
             img_height = static_cast<int>(img_width / aspect_ratio);
@@ -94,13 +415,22 @@ class Engine {
 
         bool hasImageReady() { return has_image; }
         sf::Texture& getTexture() { return texture; }
+
+        // Save the last rendered image, without going through the texture
+        bool saveImage(const char* filename) const;
+
+        // RGBA bytes of the last rendered image, rows from the top
+        const std::vector<sf::Uint8>& getPixels() const { return pixels; }
+
         int getImgWidth() { return img_width; }
         int getImgHeight() { return img_height; }
+        int getSamplesPerPixel() { return samples_per_pixel; }
 
         /* Progress bar useful methods */
         bool isWorking() { return working; }
         std::chrono::time_point<std::chrono::steady_clock> workStartTime() { return start_time; }
-        int getRemainingLines() { return remaining_lines; }
+        int getRemainingTiles() { return remaining_tiles; }
+        int getTotalTiles() { return total_tiles; }
 
         void setCamera( point3 lookfrom,
             point3 lookat,
@@ -111,17 +441,22 @@ class Engine {
             double _time1 = 0) {
                 cam = camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture,
                     focus_dist, _time0, _time1);
+                accel = nullptr; // moving objects bounds depend on the shutter times
             }
         
         void addToWorld(shared_ptr<hittable> item) {
             world.add(item);
+            accel = nullptr;
         } 
+
+        // Objects of the scene, moved in place between two calls to updateScene
+        hittable_list& getWorld() { return world; }
 };
 
 Engine::Engine() : img_width(480), img_height(400), pixels(4*img_width*img_height),
     samples_per_pixel(100), max_depth(50) {
-        texture = sf::Texture();
-        texture.create(img_width, img_height);
+        // The texture is only created by renderImage, an engine can render
+        // without any OpenGL context (headless mode)
         aspect_ratio = (double) img_width/img_height;
         point3 lookfrom(13,2,3);
         point3 lookat(0,0,0);
@@ -133,6 +468,7 @@ Engine::Engine() : img_width(480), img_height(400), pixels(4*img_width*img_heigh
 
         cam = camera(lookfrom, lookat, vup, 20.0, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
         world = random_scene();
+        buildAccelerator();
     }
 
 Engine::Engine(unsigned int image_width, unsigned int image_height, 
@@ -141,8 +477,6 @@ Engine::Engine(unsigned int image_width, unsigned int image_height,
     img_width(image_width), img_height(image_height), pixels(img_width*img_height*4),
     samples_per_pixel(samples_per_pixel), aspect_ratio(img_width / img_height), max_depth(max_depth), world(), cam()  {
 
-        texture = sf::Texture();
-        texture.create(img_width, img_height);
         // point3 lookfrom(13,2,3);
         // point3 lookat(0,0,0);
         
@@ -175,6 +509,12 @@ Engine::Engine(unsigned int image_width, unsigned int image_height,
 //     }
 
 Engine::Engine(const char* filename) {
+    if (is_binary_scene_file(filename)) {
+        loadBinaryScene(filename);
+        buildAccelerator();
+        return;
+    }
+
     tinyxml2::XMLDocument xmlDoc;
 
     tinyxml2::XMLError eResult = xmlDoc.LoadFile(filename);
@@ -191,21 +531,45 @@ Engine::Engine(const char* filename) {
     samples_per_pixel = pElement->IntAttribute("SamplesPerPixel");
     aspect_ratio = pElement->DoubleAttribute("AspectRatio");
     max_depth = pElement->IntAttribute("MaxDepth");
+    seed = pElement->Unsigned64Attribute("Seed");
+    tile_size = pElement->IntAttribute("TileSize", tile_size);
+    roulette.depth = pElement->IntAttribute("RouletteDepth", roulette.depth);
+    setRouletteProbability(pElement->DoubleAttribute("RouletteProbability", roulette.probability));
+    roulette.threshold = pElement->DoubleAttribute("RouletteThreshold", roulette.threshold);
+    adaptive.enabled = pElement->BoolAttribute("Adaptive", adaptive.enabled);
+    adaptive.min_spp = pElement->IntAttribute("MinSamplesPerPixel", adaptive.min_spp);
+    adaptive.error = pElement->DoubleAttribute("AdaptiveError", adaptive.error);
+    progressive = pElement->BoolAttribute("Progressive", progressive);
+    ray_sort = pElement->BoolAttribute("RaySort", ray_sort);
+    primary_packets = pElement->BoolAttribute("PrimaryPackets", primary_packets);
+    const char* builder_name = pElement->Attribute("BvhBuilder");
+    if (builder_name != nullptr && !parse_bvh_builder(builder_name, builder))
+        throw std::invalid_argument("Unknown BvhBuilder " + std::string(builder_name));
+    const char* precision_name = pElement->Attribute("Precision");
+    if (precision_name != nullptr && !parse_render_precision(precision_name, precision))
+        throw std::invalid_argument("Unknown Precision " + std::string(precision_name));
+    const char* integrator_name = pElement->Attribute("Integrator");
+    if (integrator_name != nullptr && !parse_render_integrator(integrator_name, integrator))
+        throw std::invalid_argument("Unknown Integrator " + std::string(integrator_name));
 
     pixels = std::vector<sf::Uint8>(4*img_width*img_height);
-    texture = sf::Texture();
-    texture.create(img_width, img_height);
 
     tinyxml2::XMLElement * pCameraElement = pElement->FirstChildElement("Camera");
     if (pCameraElement == nullptr) throw std::invalid_argument("File does not contain a camera element");
 
     cam = camera(pCameraElement);
 
+    // Optional since the first files inline a material in every object
+    material_table materials;
+    tinyxml2::XMLElement * pMaterialsElement = pRoot->FirstChildElement("Materials");
+    if (pMaterialsElement != nullptr) materials.from_xml(pMaterialsElement);
+
     tinyxml2::XMLElement * pListElement = pRoot->FirstChildElement("List");
     if (pListElement == nullptr) throw std::invalid_argument("File does not contain a list element");
 
-    world = hittable_list(pListElement);
+    world = hittable_list(pListElement, materials);
 
+    buildAccelerator();
 }
 
 void Engine::saveXmlDocument(const char* filename) const{
@@ -221,34 +585,288 @@ void Engine::saveXmlDocument(const char* filename) const{
     pElement->SetAttribute("SamplesPerPixel", samples_per_pixel);
     pElement->SetAttribute("AspectRatio", aspect_ratio);
     pElement->SetAttribute("MaxDepth", max_depth);
+    pElement->SetAttribute("Seed", seed);
+    pElement->SetAttribute("TileSize", tile_size);
+    pElement->SetAttribute("RouletteDepth", roulette.depth);
+    pElement->SetAttribute("RouletteProbability", roulette.probability);
+    pElement->SetAttribute("RouletteThreshold", roulette.threshold);
+    pElement->SetAttribute("Adaptive", adaptive.enabled);
+    pElement->SetAttribute("MinSamplesPerPixel", adaptive.min_spp);
+    pElement->SetAttribute("AdaptiveError", adaptive.error);
+    pElement->SetAttribute("Progressive", progressive);
+    pElement->SetAttribute("BvhBuilder", bvh_builder_name(builder));
+    pElement->SetAttribute("Precision", render_precision_name(precision));
+    pElement->SetAttribute("Integrator", render_integrator_name(integrator));
+    pElement->SetAttribute("RaySort", ray_sort);
+    pElement->SetAttribute("PrimaryPackets", primary_packets);
 
     pElement->InsertEndChild(cam.to_xml(xmlDoc));
     pRoot->InsertEndChild(pElement);
 
-    pRoot->InsertEndChild(world.to_xml(xmlDoc));
+    // The objects reference the distinct materials listed before them
+    material_table materials;
+    tinyxml2::XMLElement * pListElement = world.to_xml(xmlDoc, materials);
+    pRoot->InsertEndChild(materials.to_xml(xmlDoc));
+    pRoot->InsertEndChild(pListElement);
 
     xmlDoc.SaveFile(filename);
 }
 
-// Return color of a ray
-color ray_color(const ray& r, const hittable& world, int depth) {
-    hit_record rec;
-    
+void Engine::saveBinaryScene(const char* filename) const {
+    scene_file_header header = {};
+
+    header.img_width = img_width;
+    header.img_height = img_height;
+    header.samples_per_pixel = samples_per_pixel;
+    header.max_depth = max_depth;
+    header.aspect_ratio = aspect_ratio;
+    header.seed = seed;
+    header.tile_size = tile_size;
+    header.roulette_depth = roulette.depth;
+    header.roulette_probability = roulette.probability;
+    header.roulette_threshold = roulette.threshold;
+    header.adaptive = adaptive.enabled;
+    header.min_samples_per_pixel = adaptive.min_spp;
+    header.adaptive_error = adaptive.error;
+    header.progressive = progressive;
+    header.bvh_builder = static_cast<int32_t>(builder);
+    header.precision = static_cast<int32_t>(precision);
+    header.integrator = static_cast<int32_t>(integrator);
+    header.ray_sort = ray_sort;
+    header.primary_packets = primary_packets;
+
+    for (int a = 0; a < 3; a++) {
+        header.look_from[a] = cam.look_from()[a];
+        header.look_at[a] = cam.look_at()[a];
+        header.vup[a] = cam.view_up()[a];
+    }
+    header.vfov = cam.vertical_fov();
+    header.camera_aspect_ratio = cam.aspect();
+    header.aperture = cam.lens_aperture();
+    header.focus_dist = cam.focus_distance();
+    header.time0 = cam.shutter_open();
+    header.time1 = cam.shutter_close();
+
+    std::vector<scene_file_material> materials;
+    std::vector<scene_file_primitive> primitives;
+    scene_file_tables(world, materials, primitives);
+
+    write_scene_file(filename, header, materials, primitives);
+}
+
+void Engine::loadBinaryScene(const char* filename) {
+    mapped_file file(filename);
+    const scene_file_header& header = scene_file_checked_header(file);
+
+    img_width = header.img_width;
+    img_height = header.img_height;
+    samples_per_pixel = header.samples_per_pixel;
+    aspect_ratio = header.aspect_ratio;
+    max_depth = header.max_depth;
+    seed = header.seed;
+    tile_size = header.tile_size;
+    roulette.depth = header.roulette_depth;
+    setRouletteProbability(header.roulette_probability);
+    roulette.threshold = header.roulette_threshold;
+    adaptive.enabled = header.adaptive != 0;
+    adaptive.min_spp = header.min_samples_per_pixel;
+    adaptive.error = header.adaptive_error;
+    progressive = header.progressive != 0;
+    builder = header.bvh_builder == static_cast<int32_t>(bvh_builder::lbvh) ? bvh_builder::lbvh : bvh_builder::sah;
+    precision = header.precision == static_cast<int32_t>(render_precision::float32)
+                ? render_precision::float32 : render_precision::float64;
+    integrator = header.integrator == static_cast<int32_t>(render_integrator::wavefront)
+                 ? render_integrator::wavefront : render_integrator::megakernel;
+    ray_sort = header.ray_sort != 0;
+    primary_packets = header.primary_packets != 0;
+
+    pixels = std::vector<sf::Uint8>(4*img_width*img_height);
+
+    auto vec = [](const double v[3]) { return vec3(v[0], v[1], v[2]); };
+    cam = camera(vec(header.look_from), vec(header.look_at), vec(header.vup),
+                 header.vfov, header.camera_aspect_ratio, header.aperture, header.focus_dist,
+                 header.time0, header.time1);
+
+    // The tables are read straight from the mapping
+    auto material_records = reinterpret_cast<const scene_file_material*>(file.data() + header.materials_offset);
+    std::vector<shared_ptr<material>> materials;
+    materials.reserve(header.n_materials);
+    for (uint64_t i = 0; i < header.n_materials; i++)
+        materials.push_back(material_from_record(material_records[i]));
+
+    auto primitive_records = reinterpret_cast<const scene_file_primitive*>(file.data() + header.primitives_offset);
+    world = scene_file_objects(primitive_records, header.n_primitives, materials);
+}
+
+bool Engine::saveImage(const char* filename) const {
+    sf::Image image;
+    image.create(img_width, img_height, pixels.data());
+    return image.saveToFile(filename);
+}
+
+void Engine::saveTileTimings(const char* filename) const {
+    std::ofstream out(filename);
+    if (!out) throw std::invalid_argument("Cannot open " + std::string(filename));
+
+    out << "x,y,width,height,worker,seconds\n";
+    for (auto & t : tile_timings)
+        out << t.x << ',' << t.y << ',' << t.width << ',' << t.height << ','
+            << t.worker << ',' << t.seconds << '\n';
+}
+
+std::string Engine::ignoredSettings() {
+    if (accel == nullptr) buildAccelerator();
+
+    std::string ignored;
+    bool other_modes = progressive || adaptive.enabled || heatmap != heatmap_metric::none;
+    if (integrator == render_integrator::wavefront && !usesWavefront())
+        ignored += "Integrator wavefront ignored with Adaptive, Progressive or Heatmap (megakernel used)\n";
+    if (ray_sort && !usesWavefront())
+        ignored += "RaySort ignored, it only applies to the wavefront integrator\n";
+    if (primary_packets && !usesPrimaryPackets()) {
+        ignored += "PrimaryPackets ignored ";
+        if (usesWavefront()) ignored += "with the wavefront integrator\n";
+        else if (other_modes) ignored += "with Adaptive, Progressive or Heatmap\n";
+        else ignored += "without a bounding volume hierarchy (empty scene)\n";
+    }
+    return ignored;
+}
+
+void Engine::buildAccelerator() {
+    if (world.objects.empty()) {
+        accel = nullptr;
+        return;
+    }
+    accel = make_shared<linear_bvh>(world, cam.shutter_open(), cam.shutter_close(), builder);
+}
+
+bool Engine::updateScene() {
+    if (accel != nullptr) {
+        accel->refit();
+        if (accel->sah_degradation() <= refit_threshold) return false;
+    }
+    buildAccelerator();
+    return true;
+}
+
+// Light of the sky in the direction of a ray that escaped the scene
+template <typename T>
+inline vec3_t<T> sky_color(const ray_t<T>& r) {
+    vec3_t<T> unit_direction = unit_vector(r.direction());
+    auto t = T(0.5)*(unit_direction.y() + T(1));
+    return (1-t)*vec3_t<T>(1.0, 1.0, 1.0) + t*vec3_t<T>(0.5, 0.7, 1.0);
+}
+
+// Return color of a ray, following its path iteratively: throughput holds the
+// product of the attenuations met so far. The whole path is traced in the
+// precision of r. The first intersection is given, hit and rec being the
+// result of world.hit for r (the camera rays of a packet).
+template <typename T>
+vec3_t<T> ray_color(
+    const ray_t<T>& r, bool hit, hit_record_t<T> rec, const hittable& world, int max_depth, const roulette_settings& roulette
+) {
+    typedef vec3_t<T> color;
+    color throughput(1, 1, 1);
+    ray_t<T> current = r;
+
     // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
-        
-    if (world.hit(r, 0.001, infinity, rec)) {        
-        ray scattered;
+    for (int depth = 0; depth < max_depth; depth++) {
+        if (depth > 0) {
+            RT_STAT(thread_ray_stats().scattered_rays++);
+            hit = world.hit(current, T(0.001), T(infinity), rec);
+        }
+
+        if (!hit) {
+            RT_STAT(thread_ray_stats().escaped++; thread_ray_stats().add_path(depth + 1));
+            return throughput * sky_color(current);
+        }
+
+        ray_t<T> scattered;
         color attenuation;
+        if (!scatter_material(*rec.mat_ptr, current, rec, attenuation, scattered)) {
+            RT_STAT(thread_ray_stats().absorbed++; thread_ray_stats().add_path(depth + 1));
+            return color(0,0,0);
+        }
+
+        throughput = throughput * attenuation;
+        current = scattered;
+
+        if (roulette.depth > 0 && depth + 1 >= roulette.depth) {
+            auto max_throughput = fmax(throughput.x(), fmax(throughput.y(), throughput.z()));
+            if (max_throughput < roulette.threshold) {
+                // Survivors are reweighted, the estimate stays unbiased
+                if (random_double() >= roulette.probability) {
+                    RT_STAT(thread_ray_stats().roulette_kills++; thread_ray_stats().add_path(depth + 1));
+                    return color(0,0,0);
+                }
+                throughput /= roulette.probability;
+            }
+        }
+    }
+
+    RT_STAT(thread_ray_stats().add_path(max_depth));
+    return color(0,0,0);
+}
+
+template <typename T>
+vec3_t<T> ray_color(const ray_t<T>& r, const hittable& world, int max_depth, const roulette_settings& roulette) {
+    hit_record_t<T> rec;
+    bool hit = max_depth > 0 && world.hit(r, T(0.001), T(infinity), rec);
+    return ray_color(r, hit, rec, world, max_depth, roulette);
+}
+
+const hittable& Engine::sceneToTrace() {
+    if (accel == nullptr) buildAccelerator();
+    return accel ? static_cast<const hittable&>(*accel) : static_cast<const hittable&>(world);
+}
+
+color Engine::traceSample(int i, int j, const hittable& scene) const {
+    auto u = (i + random_double()) / (img_width-1);
+    auto v = (j + random_double()) / (img_height-1);
+    RT_STAT(thread_ray_stats().primary_rays++);
+    if (precision == render_precision::float32) {
+        rayf r = cam.get_ray(static_cast<float>(u), static_cast<float>(v));
+        return color(ray_color(r, scene, max_depth, roulette));
+    }
+    ray r = cam.get_ray(u, v);
+    return ray_color(r, scene, max_depth, roulette);
+}
+
+int Engine::samplePixel(int i, int j, const hittable& scene, color& pixel_color) const {
+    seed_thread_rng(seed, static_cast<uint64_t>(j) * img_width + i);
+
+    auto sample = [&]() { return traceSample(i, j, scene); };
+
+    if (!adaptive.enabled) {
+        for (int s = 0; s < samples_per_pixel; ++s)
+            pixel_color += sample();
+        return samples_per_pixel;
+    }
+
+    // Running mean and variance of the luminance (Welford)
+    int n = 0;
+    double mean = 0, m2 = 0;
+    int min_spp = std::min(std::max(adaptive.min_spp, 2), samples_per_pixel);
+    int round = std::max(adaptive.round, 1);
+
+    while (n < samples_per_pixel) {
+        int batch = std::min(n == 0 ? min_spp : round, samples_per_pixel - n);
+        for (int s = 0; s < batch; ++s) {
+            color c = sample();
+            pixel_color += c;
+            double luminance = 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+            n++;
+            double delta = luminance - mean;
+            mean += delta / n;
+            m2 += delta * (luminance - mean);
+        }
 
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth-1);
-        return color(0,0,0);
+        double half_interval = 1.96 * sqrt(m2 / (n - 1) / n);
+        if (half_interval <= adaptive.error * fmax(mean, 1e-2))
+            break;
     }
-    vec3 unit_direction = unit_vector(r.direction());
-    auto t = 0.5*(unit_direction.y() + 1.0);
-    return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
+
+    return n;
 }
 
 void Engine::createImage() 
@@ -270,39 +888,405 @@ void Engine::createImage()
 
 	// Render
     if (working) {
-        // Render
-        [[gnu::unused]] // pour spécifier que s ne sera pas utilisé
-        int s; // pour que omp reconnaisse s en private
-        pixels.clear();
-        // std::cout << "P3\n" << img_width << ' ' << img_height
-        //  << "\n255\n";
-
-        // working = true;
+        if (progressive) {
+            // Same passes as the live preview, back to back
+            while (working) renderPass();
+            return;
+        }
+
+        // Every pixel is written, no need to clear the buffer
+        pixels.resize(4*img_width*img_height);
+        const hittable& scene = sceneToTrace();
+
+        samples_taken = 0;
+        frame_stats.reset();
+        if (heatmap != heatmap_metric::none) pixel_cost.assign(img_width*img_height, 0.0);
+        total_tiles = tileCount();
+        remaining_tiles = total_tiles;
         start_time = std::chrono::steady_clock::now();
-        for (int j = img_height-1; j >= 0; --j) {
-            // std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush; 
-            remaining_lines = j;
-            #pragma omp parallel for schedule(dynamic, 10)
-            for (int i = 0; i < img_width; ++i) {
+        if (usesWavefront()) {
+            renderTileGrid([&](const tile& tl) {
+                return precision == render_precision::float32 ? traceTileWavefront<float>(tl, scene)
+                                                              : traceTileWavefront<double>(tl, scene);
+            });
+        }
+        else if (usesPrimaryPackets()) {
+            renderTileGrid([&](const tile& tl) {
+                return precision == render_precision::float32 ? traceTilePackets<float>(tl, *accel)
+                                                              : traceTilePackets<double>(tl, *accel);
+            });
+        }
+        else {
+            renderTiles([&](int i, int j, int row) {
                 color pixel_color(0, 0, 0);
-                for (int s = 0; s < samples_per_pixel; ++s) {
+                int n_samples = samplePixel(i, j, scene, pixel_color);
+                write_color(pixels, pixel_color, n_samples, row, i, img_width);
+                return n_samples;
+            });
+        }
+
+        std::chrono::duration<double> frame_time = std::chrono::steady_clock::now() - start_time;
+        frame_seconds = frame_time.count();
+        working = false;
+        has_image = true;
+    }
+}
+
+void Engine::renderPass() {
+    if (!working) return;
+
+    const hittable& scene = sceneToTrace();
+    int n_pixels = img_width * img_height;
+
+    if (passes_done == 0) {
+        accumulation.assign(3 * n_pixels, 0.0f);
+        pixels.resize(4 * n_pixels);
+        samples_taken = 0;
+        frame_stats.reset();
+        if (heatmap != heatmap_metric::none) pixel_cost.assign(n_pixels, 0.0);
+        stop_requested = false;
+        start_time = std::chrono::steady_clock::now();
+    }
+
+    // Progress over the whole progressive render
+    int pass = passes_done;
+    total_tiles = tileCount() * samples_per_pixel;
+    remaining_tiles = tileCount() * (samples_per_pixel - pass);
+
+    renderTiles([&](int i, int j, int row) {
+        // One stream per pixel and per pass, the passes are independent
+        uint64_t pixel = static_cast<uint64_t>(j) * img_width + i;
+        seed_thread_rng(seed, static_cast<uint64_t>(pass) * n_pixels + pixel);
+
+        color c = traceSample(i, j, scene);
+        float* acc = &accumulation[3 * (row * img_width + i)];
+        acc[0] += static_cast<float>(c.x());
+        acc[1] += static_cast<float>(c.y());
+        acc[2] += static_cast<float>(c.z());
+
+        write_color(pixels, color(acc[0], acc[1], acc[2]), pass + 1, row, i, img_width);
+        return 1;
+    });
+    passes_done++;
+    has_image = true;
+
+    std::chrono::duration<double> frame_time = std::chrono::steady_clock::now() - start_time;
+    frame_seconds = frame_time.count();
+
+    if (passes_done >= samples_per_pixel || stop_requested) {
+        working = false;
+        stop_requested = false;
+        passes_done = 0;
+    }
+}
+
+// Scatter the paths order[first, last) of a wave, which all hit a material
+// of class M, and move the survivors to next. The materials of the engine are
+// final, their scatter is called without virtual dispatch.
+template <typename M, typename T>
+void scatter_wave(
+    const std::vector<wavefront_path<T>>& wave, const std::vector<hit_record_t<T>>& hits,
+    const std::vector<uint32_t>& order, size_t first, size_t last,
+    int depth, const roulette_settings& roulette, std::vector<wavefront_path<T>>& next
+) {
+    for (size_t k = first; k < last; k++) {
+        wavefront_path<T> path = wave[order[k]];
+        const hit_record_t<T>& rec = hits[order[k]];
+        const M& m = static_cast<const M&>(*rec.mat_ptr);
+
+        // The material and the roulette draw from the generator of the path
+        thread_rng() = path.rng;
+        ray_t<T> scattered;
+        vec3_t<T> attenuation;
+        if (!m.scatter(path.r, rec, attenuation, scattered)) {
+            RT_STAT(thread_ray_stats().absorbed++; thread_ray_stats().add_path(depth + 1));
+            continue;
+        }
+
+        path.throughput = path.throughput * attenuation;
+        path.r = scattered;
+
+        if (roulette.depth > 0 && depth + 1 >= roulette.depth) {
+            auto max_throughput = fmax(path.throughput.x(), fmax(path.throughput.y(), path.throughput.z()));
+            if (max_throughput < roulette.threshold) {
+                if (random_double() >= roulette.probability) {
+                    RT_STAT(thread_ray_stats().roulette_kills++; thread_ray_stats().add_path(depth + 1));
+                    continue;
+                }
+                path.throughput /= roulette.probability;
+            }
+        }
+
+        path.rng = thread_rng();
+        next.push_back(path);
+    }
+}
+
+template <typename T>
+long long Engine::traceTileWavefront(const tile& tl, const hittable& scene) {
+    const int tile_width = tl.x1 - tl.x0;
+    const int tile_pixels = tile_width * (tl.y1 - tl.y0);
+    const uint64_t n_pixels = static_cast<uint64_t>(img_width) * img_height;
+    const size_t n_kinds = static_cast<size_t>(material_kind::other) + 1;
+
+    // Reused from a tile to the next, the waves of a thread keep their capacity
+    thread_local std::vector<wavefront_path<T>> wave, next;
+    thread_local std::vector<hit_record_t<T>> hits;
+    thread_local std::vector<uint32_t> order;
+    thread_local std::vector<bvh_morton_item> sort_keys, sort_buffer;
+    thread_local std::vector<color> radiance;
+    radiance.assign(tile_pixels, color(0, 0, 0));
+
+    // Samples of the tile numbered pass by pass, a wave traces the next
+    // wavefront_max_paths of them
+    const long long n_samples = static_cast<long long>(tile_pixels) * samples_per_pixel;
+    for (long long first = 0; first < n_samples; first += wavefront_max_paths) {
+        long long last = std::min(n_samples, first + static_cast<long long>(wavefront_max_paths));
+
+        // Camera rays, on the streams of the progressive passes
+        wave.clear();
+        for (long long k = first; k < last; k++) {
+            int p = static_cast<int>(k % tile_pixels);
+            uint64_t pass = static_cast<uint64_t>(k / tile_pixels);
+            int i = tl.x0 + p % tile_width;
+            int j = (img_height-1) - (tl.y0 + p / tile_width);
+            seed_thread_rng(seed, pass * n_pixels + static_cast<uint64_t>(j) * img_width + i);
+
+            auto u = (i + random_double()) / (img_width-1);
+            auto v = (j + random_double()) / (img_height-1);
+            RT_STAT(thread_ray_stats().primary_rays++);
+
+            wavefront_path<T> path;
+            path.r = cam.get_ray(static_cast<T>(u), static_cast<T>(v));
+            path.throughput = vec3_t<T>(1, 1, 1);
+            path.rng = thread_rng();
+            path.pixel = p;
+            wave.push_back(path);
+        }
+
+        for (int depth = 0; depth < max_depth && !wave.empty(); depth++) {
+            // The camera rays of a tile are coherent already, the bounces
+            // are put back in order. The cells divide the bounds of the
+            // origins, those of the scene are mostly empty (ground sphere).
+            if (ray_sort && depth > 0) {
+                aabb origins(point3(wave[0].r.origin()), point3(wave[0].r.origin()));
+                for (size_t k = 1; k < wave.size(); k++) {
+                    point3 o(wave[k].r.origin());
+                    origins = surrounding_box(origins, aabb(o, o));
+                }
+                sort_keys.resize(wave.size());
+                for (size_t k = 0; k < wave.size(); k++)
+                    sort_keys[k] = { ray_sort_key(wave[k].r, origins), static_cast<uint32_t>(k) };
+                // Already on a render thread: no nested parallel region
+                bvh_radix_sort_serial(sort_keys, 3 * ray_sort_cell_bits + 3, sort_buffer);
+                next.resize(wave.size());
+                for (size_t k = 0; k < wave.size(); k++)
+                    next[k] = wave[sort_keys[k].index];
+                std::swap(wave, next);
+            }
+
+            // Intersect the whole wave, the escaped paths gather the sky
+            hits.resize(wave.size());
+            size_t count[n_kinds] = {};
+            size_t n_hits = 0;
+            for (size_t k = 0; k < wave.size(); k++) {
+                RT_STAT(if (depth > 0) thread_ray_stats().scattered_rays++);
+                if (!scene.hit(wave[k].r, T(0.001), T(infinity), hits[k])) {
+                    RT_STAT(thread_ray_stats().escaped++; thread_ray_stats().add_path(depth + 1));
+                    radiance[wave[k].pixel] += color(wave[k].throughput * sky_color(wave[k].r));
+                    hits[k].mat_ptr = nullptr;
+                    continue;
+                }
+                count[static_cast<size_t>(hits[k].mat_ptr->kind)]++;
+                n_hits++;
+            }
+
+            // Counting sort of the hits by material kind
+            size_t start[n_kinds + 1] = {};
+            for (size_t m = 0; m < n_kinds; m++) start[m + 1] = start[m] + count[m];
+            order.resize(n_hits);
+            size_t fill[n_kinds];
+            std::copy(start, start + n_kinds, fill);
+            for (size_t k = 0; k < wave.size(); k++)
+                if (hits[k].mat_ptr != nullptr)
+                    order[fill[static_cast<size_t>(hits[k].mat_ptr->kind)]++] = static_cast<uint32_t>(k);
+
+            // Each material scatters its paths in one run
+            next.clear();
+            size_t lambertian_bin = static_cast<size_t>(material_kind::lambertian);
+            size_t metal_bin = static_cast<size_t>(material_kind::metal);
+            size_t dielectric_bin = static_cast<size_t>(material_kind::dielectric);
+            size_t other_bin = static_cast<size_t>(material_kind::other);
+            scatter_wave<lambertian>(wave, hits, order, start[lambertian_bin], start[lambertian_bin + 1], depth, roulette, next);
+            scatter_wave<metal>(wave, hits, order, start[metal_bin], start[metal_bin + 1], depth, roulette, next);
+            scatter_wave<dielectric>(wave, hits, order, start[dielectric_bin], start[dielectric_bin + 1], depth, roulette, next);
+            scatter_wave<material>(wave, hits, order, start[other_bin], start[other_bin + 1], depth, roulette, next);
+            std::swap(wave, next);
+        }
+
+        // Paths still alive after max_depth bounces gather no light
+        RT_STAT(for (size_t k = 0; k < wave.size(); k++) thread_ray_stats().add_path(max_depth));
+    }
+
+    for (int p = 0; p < tile_pixels; p++) {
+        int row = tl.y0 + p / tile_width;
+        int i = tl.x0 + p % tile_width;
+        write_color(pixels, radiance[p], samples_per_pixel, row, i, img_width);
+    }
+    return n_samples;
+}
+
+template <typename T>
+long long Engine::traceTilePackets(const tile& tl, const linear_bvh& bvh) {
+    const int size = ray_packet<T>::size;
+
+    for (int row0 = tl.y0; row0 < tl.y1; row0 += 2) {
+        for (int i0 = tl.x0; i0 < tl.x1; i0 += 2) {
+            // Lanes row by row, each on the random sequence of its pixel
+            ray_packet<T> packet;
+            hit_record_t<T> recs[size];
+            pcg32 rng[size];
+            color pixel_color[size];
+            for (int l = 0; l < size; l++) {
+                int i = i0 + l % 2, row = row0 + l / 2;
+                if (i >= tl.x1 || row >= tl.y1) continue;
+                packet.active |= 1 << l;
+                seed_thread_rng(seed, static_cast<uint64_t>((img_height-1) - row) * img_width + i);
+                rng[l] = thread_rng();
+            }
+
+            for (int s = 0; s < samples_per_pixel; ++s) {
+                // Same draws as traceSample
+                for (int l = 0; l < size; l++) {
+                    if (!(packet.active & (1 << l))) continue;
+                    int i = i0 + l % 2, j = (img_height-1) - (row0 + l / 2);
+                    thread_rng() = rng[l];
                     auto u = (i + random_double()) / (img_width-1);
                     auto v = (j + random_double()) / (img_height-1);
-                    ray r = cam.get_ray(u, v);
-                    pixel_color += ray_color(r, world, max_depth);
+                    RT_STAT(thread_ray_stats().primary_rays++);
+                    packet.r[l] = cam.get_ray(static_cast<T>(u), static_cast<T>(v));
+                    rng[l] = thread_rng();
+                }
+
+                int hits = bvh.hit_packet(packet, T(0.001), T(infinity), recs);
+
+                for (int l = 0; l < size; l++) {
+                    if (!(packet.active & (1 << l))) continue;
+                    thread_rng() = rng[l];
+                    pixel_color[l] += color(ray_color(packet.r[l], (hits & (1 << l)) != 0, recs[l], bvh, max_depth, roulette));
+                    rng[l] = thread_rng();
                 }
-                write_color(pixels, pixel_color, samples_per_pixel, (img_height-1) - j, i, img_width);
             }
+
+            for (int l = 0; l < size; l++)
+                if (packet.active & (1 << l))
+                    write_color(pixels, pixel_color[l], samples_per_pixel, row0 + l / 2, i0 + l % 2, img_width);
         }
-        working = false;
-        has_image = true;
-        // work=false;
     }
-	
+    return static_cast<long long>(tl.x1 - tl.x0) * (tl.y1 - tl.y0) * samples_per_pixel;
+}
+
+template <typename TileFunction>
+void Engine::renderTileGrid(TileFunction render_tile) {
+    // One parallel region per frame, the workers pull tiles from the scheduler
+    tile_scheduler scheduler(img_width, img_height, tile_size, omp_get_max_threads());
+    const std::vector<tile>& tiles = scheduler.tiles();
+    tile_timings.assign(tiles.size(), tile_timing());
+
+    #pragma omp parallel
+    {
+        int worker = omp_get_thread_num();
+        int t;
+        RT_STAT(thread_ray_stats().reset(); thread_node_cache().reset());
+
+        while (scheduler.next(worker, t)) {
+            auto tile_start = std::chrono::steady_clock::now();
+            const tile& tl = tiles[t];
+
+            long long tile_samples = render_tile(tl);
+
+            #pragma omp atomic
+            samples_taken += tile_samples;
+
+            std::chrono::duration<double> tile_time = std::chrono::steady_clock::now() - tile_start;
+            tile_timings[t] = { tl.x0, tl.y0, tl.x1 - tl.x0, tl.y1 - tl.y0, worker, tile_time.count() };
+
+            #pragma omp atomic
+            remaining_tiles--;
+        }
+
+        // Counters merged once per thread and per frame
+        #pragma omp critical(ray_stats_merge)
+        frame_stats.merge(thread_ray_stats());
+    }
+}
+
+template <typename PixelFunction>
+void Engine::renderTiles(PixelFunction render_pixel) {
+    renderTileGrid([&](const tile& tl) {
+        long long tile_samples = 0;
+        for (int row = tl.y0; row < tl.y1; ++row) {
+            int j = (img_height-1) - row;
+            for (int i = tl.x0; i < tl.x1; ++i) {
+                if (heatmap == heatmap_metric::none) {
+                    tile_samples += render_pixel(i, j, row);
+                    continue;
+                }
+
+                // Same pixel loop, with the cost of each pixel recorded
+                auto pixel_start = std::chrono::steady_clock::now();
+                uint64_t tests_before = 0;
+                RT_STAT(tests_before = thread_ray_stats().primitive_tests + thread_ray_stats().node_visits);
+
+                tile_samples += render_pixel(i, j, row);
+
+                double cost = 0;
+                if (heatmap == heatmap_metric::time) {
+                    std::chrono::duration<double> pixel_time = std::chrono::steady_clock::now() - pixel_start;
+                    cost = pixel_time.count();
+                }
+                RT_STAT(if (heatmap == heatmap_metric::tests)
+                    cost = (double) (thread_ray_stats().primitive_tests + thread_ray_stats().node_visits - tests_before));
+                pixel_cost[row*img_width + i] += cost;
+            }
+        }
+        return tile_samples;
+    });
+}
+
+double Engine::getHeatmapScale() const {
+    std::vector<double> costs;
+    costs.reserve(pixel_cost.size());
+    for (double c : pixel_cost)
+        if (c > 0) costs.push_back(c);
+    if (costs.empty()) return 0.0;
+
+    auto p99 = costs.begin() + (costs.size() - 1) * 99 / 100;
+    std::nth_element(costs.begin(), p99, costs.end());
+    return *p99;
+}
+
+bool Engine::saveHeatmap(const char* filename) const {
+    if (pixel_cost.size() != (size_t) img_width*img_height) return false;
+
+    double scale = getHeatmapScale();
+    std::vector<sf::Uint8> heat(4*img_width*img_height);
+    for (int row = 0; row < img_height; row++)
+        for (int i = 0; i < img_width; i++) {
+            double t = scale > 0 ? pixel_cost[row*img_width + i] / scale : 0.0;
+            write_color(heat, heat_color(t), 1, row, i, img_width);
+        }
+
+    sf::Image image;
+    image.create(img_width, img_height, heat.data());
+    return image.saveToFile(filename);
 }
 
 void Engine::renderImage() {
-    createImage();
+    if (progressive)
+        renderPass();
+    else
+        createImage();
     texture.create(img_width, img_height);
     texture.update(pixels.data());
 }
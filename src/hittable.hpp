@@ -8,26 +8,52 @@
 #include "../include/tinyxml2.h"
 
 class material;
-
-struct hit_record {
-    point3 p;
-    vec3 normal;
-    shared_ptr<material> mat_ptr; //pointeur spécifique (cf tuto)
-    double t;
+class material_table;
+
+template <typename T>
+struct hit_record_t {
+    vec3_t<T> p;
+    vec3_t<T> normal;
+    // Non-owning: the materials are owned by the objects of the scene, copying
+    // a shared_ptr on every hit would hammer its atomic reference count
+    const material* mat_ptr;
+    T t;
     bool front_face;
 
-    inline void set_face_normal(const ray& r, const vec3& outward_normal) {
+    inline void set_face_normal(const ray_t<T>& r, const vec3_t<T>& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal :-outward_normal;
     }
 };
 
+using hit_record = hit_record_t<double>;
+using hit_recordf = hit_record_t<float>;
+
 class hittable {
     public:
+        // rec is only written when a hit closer than t_max is found
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        // Single precision intersection. By default the ray goes through the
+        // double test, the objects on the hot path override it with a float
+        // instantiation of their kernel
+        virtual bool hit(const rayf& r, float t_min, float t_max, hit_recordf& rec) const;
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
         virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const = 0;
+        // Same element, materials referenced by their id in the table
+        virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc, material_table& materials) const {
+            return to_xml(xmlDoc);
+        }
 };
 
+bool hittable::hit(const rayf& r, float t_min, float t_max, hit_recordf& rec) const {
+    hit_record rec_double;
+    if (!hit(ray(r), t_min, t_max, rec_double)) return false;
+    rec.p = point3f(rec_double.p);
+    rec.normal = vec3f(rec_double.normal);
+    rec.mat_ptr = rec_double.mat_ptr;
+    rec.t = static_cast<float>(rec_double.t);
+    rec.front_face = rec_double.front_face;
+    return true;
+}
 
 #endif
@@ -5,6 +5,7 @@
 #include "sphere.hpp"
 #include "moving_sphere.hpp"
 #include "aabb.hpp"
+#include "ray_stats.hpp"
 
 #include <memory>
 #include <vector>
@@ -27,7 +28,8 @@ class hittable_list : public hittable {
         hittable_list() {}  
         hittable_list(shared_ptr<hittable> object) { add(object); }
         hittable_list(const char* xml_filename);
-        hittable_list(tinyxml2::XMLElement * pElement);
+        // Equal materials of the list are shared through the table
+        hittable_list(tinyxml2::XMLElement * pElement, material_table& materials);
 
         void clear() { objects.clear(); }
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
@@ -35,27 +37,45 @@ class hittable_list : public hittable {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit(
+            const rayf& r, float t_min, float t_max, hit_recordf& rec) const override;
+
 		virtual bool bounding_box(
             double time0, double time1, aabb& output_box) const override;
 
         virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const override;
 
+        virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc, material_table& materials) const override;
+
         void saveXmlDocument(char* filename);
 
     public:
         std::vector<shared_ptr<hittable>> objects;
+
+    private:
+        template <typename T>
+        bool hit_kernel(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) const;
 };
 
 bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    hit_record temp_rec;
+    return hit_kernel(r, t_min, t_max, rec);
+}
+
+bool hittable_list::hit(const rayf& r, float t_min, float t_max, hit_recordf& rec) const {
+    return hit_kernel(r, t_min, t_max, rec);
+}
+
+template <typename T>
+bool hittable_list::hit_kernel(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) const {
     bool hit_anything = false;
     auto closest_so_far = t_max;
+    RT_STAT(thread_ray_stats().primitive_tests += objects.size());
 
+    // Each hit is closer than the previous one, it can be written in place
     for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+        if (object->hit(r, t_min, closest_so_far, rec)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
         }
     }
 
@@ -90,6 +110,15 @@ tinyxml2::XMLElement* hittable_list::to_xml(tinyxml2::XMLDocument& xmlDoc) const
     return pElement;
 }
 
+tinyxml2::XMLElement* hittable_list::to_xml(tinyxml2::XMLDocument& xmlDoc, material_table& materials) const {
+    tinyxml2::XMLElement * pElement = xmlDoc.NewElement("List");
+
+    for (auto & item : objects)
+        pElement->InsertEndChild(item->to_xml(xmlDoc, materials));
+
+    return pElement;
+}
+
 // void hittable_list::saveXmlDocument(char* filename) {
 //     tinyxml2::XMLDocument xmlDoc;
 
@@ -102,15 +131,15 @@ tinyxml2::XMLElement* hittable_list::to_xml(tinyxml2::XMLDocument& xmlDoc) const
 //     xmlDoc.SaveFile(filename);
 // }
 
-hittable_list::hittable_list(tinyxml2::XMLElement * pElement) {
+hittable_list::hittable_list(tinyxml2::XMLElement * pElement, material_table& materials) {
     tinyxml2::XMLElement * pListElement = pElement->FirstChildElement();
     while (pListElement != nullptr)
     {
         if (strcmp(pListElement->Name(), "Sphere") == 0) {
-            objects.push_back(make_shared<sphere>(pListElement));
+            objects.push_back(make_shared<sphere>(pListElement, materials));
         }
         else if (strcmp(pListElement->Name(), "Moving_Sphere") == 0) {
-            objects.push_back(make_shared<moving_sphere>(pListElement));
+            objects.push_back(make_shared<moving_sphere>(pListElement, materials));
         }
         else {
             throw std::invalid_argument("Object not defined or list inside list");
@@ -150,14 +179,16 @@ hittable_list::hittable_list(tinyxml2::XMLElement * pElement) {
 
 // }
 
-hittable_list random_scene() {
+// Small spheres on a grid of (2 * extent)^2 cells, one per cell, around three
+// large ones. The example scenes use extent = 11, larger ones stress the bvh.
+hittable_list random_scene(int extent = 11) {
     hittable_list world;
 
     auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
     world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
 
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
+    for (int a = -extent; a < extent; a++) {
+        for (int b = -extent; b < extent; b++) {
             auto choose_mat = random_double();
             point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
 
@@ -0,0 +1,801 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "rt.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "bvh.hpp"
+#include "sphere_set.hpp"
+#include "primitive_array.hpp"
+#include "ray_packet.hpp"
+#include "ray_stats.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+#include <stdexcept>
+
+#include "../include/tinyxml2.h"
+
+// Node of a flattened bvh, laid out in depth-first order: the first child of
+// an interior node is the next node in the array, only the second child
+// offset is stored. Bounds are kept in float, rounded outwards, so that
+// a node fits in 32 bytes (two nodes per cache line).
+struct linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    union {
+        int32_t primitives_offset;   // leaf
+        int32_t second_child_offset; // interior
+    };
+    uint16_t n_primitives;           // 0 -> interior node
+    uint8_t axis;                    // interior node split axis, the first
+                                     // child holds the smaller coordinates
+    uint8_t flags;                   // linear_bvh_moving_bounds
+};
+
+// The node bounds are those at the start of the shutter interval and move
+// with the deltas of the node in linear_bvh::end_bounds
+static const uint8_t linear_bvh_moving_bounds = 1;
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must be 32 bytes");
+
+// Motion of the bounds of a node over the shutter interval, the bounds of the
+// node itself being those at its start. The objects move linearly, so bounds
+// interpolated between both ends enclose them at any time in between; the
+// deltas are rounded outwards like the bounds.
+struct linear_bvh_motion_bounds {
+    float delta_min[3];
+    float delta_max[3];
+};
+
+struct linear_bvh_stats {
+    size_t nodes = 0;
+    size_t leaves = 0;
+    size_t primitives = 0;
+    int max_depth = 0;
+    size_t node_bytes = 0;
+    size_t primitive_bytes = 0;
+    size_t moving_nodes = 0;
+    double sah_cost = 0;
+    double sah_degradation = 1;
+};
+
+inline std::ostream& operator<<(std::ostream &out, const linear_bvh_stats &s) {
+    return out << "BVH nodes: " << s.nodes << " (" << s.leaves << " leaves)\n"
+               << "BVH primitives: " << s.primitives
+               << " (" << (s.leaves ? (double) s.primitives / s.leaves : 0.0) << " per leaf)\n"
+               << "BVH max depth: " << s.max_depth << '\n'
+               << "BVH memory: " << s.node_bytes << " bytes of nodes + "
+               << s.primitive_bytes << " bytes of primitive references\n"
+               << "BVH moving nodes: " << s.moving_nodes << '\n'
+               << "BVH SAH cost: " << s.sah_cost << " (" << s.sah_degradation << " times the built tree)\n";
+}
+
+// How a linear_bvh is built: sah splits each node where the surface area
+// heuristic is lowest, lbvh sorts the primitives along a Morton curve and
+// splits on the bits of their codes, several times faster for a tree that
+// traces slower
+enum class bvh_builder { sah, lbvh };
+
+inline const char* bvh_builder_name(bvh_builder builder) {
+    return builder == bvh_builder::lbvh ? "lbvh" : "sah";
+}
+
+// False for an unknown name
+inline bool parse_bvh_builder(const char* name, bvh_builder& builder) {
+    if (strcmp(name, "sah") == 0) builder = bvh_builder::sah;
+    else if (strcmp(name, "lbvh") == 0) builder = bvh_builder::lbvh;
+    else return false;
+    return true;
+}
+
+// Bounding volume hierarchy stored as a contiguous array of linear_bvh_node.
+// The primitives are reordered so that each leaf references a contiguous
+// range of them, and the traversal walks the array with an explicit stack,
+// visiting the nearest child first.
+class linear_bvh : public hittable {
+    public:
+        linear_bvh() {}
+
+        linear_bvh(const hittable_list& list, double time0, double time1, bvh_builder builder = bvh_builder::sah);
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        // The nodes are in float already, a float ray is traversed without
+        // any conversion
+        virtual bool hit(
+            const rayf& r, float t_min, float t_max, hit_recordf& rec) const override;
+
+        // Intersect the rays of a packet, recs[l] being the closest hit of
+        // lane l as hit would give it; returns the mask of the lanes that hit.
+        // The packet tests each node against all its rays at once while they
+        // share an octant and at least two of them cross the node, the rays
+        // go on one by one otherwise.
+        template <typename T>
+        int hit_packet(const ray_packet<T>& packet, T t_min, T t_max, hit_record_t<T>* recs) const;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+        virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const override;
+
+        linear_bvh_stats stats() const;
+
+        // Update the bounds after the primitives moved, keeping the topology:
+        // much cheaper than a rebuild, but the tree degrades as the primitives
+        // drift away from where they were when it was built
+        void refit();
+
+        // Expected cost of a ray under the cost model of the build, relative
+        // to one primitive intersection
+        double sah_cost() const { return nodes.empty() ? 0 : subtree_costs()[0]; }
+
+        // Mean over the interior nodes of the SAH cost of their subtree relative to
+        // its cost when built, 1 for a tree fresh out of the builder. Unlike
+        // sah_cost, a large primitive (the ground) does not hide the rest of
+        // the tree degrading.
+        double sah_degradation() const;
+
+    public:
+        std::vector<linear_bvh_node> nodes;
+        // Empty for a static scene, else one per node: motion of the bounds
+        // of the nodes flagged linear_bvh_moving_bounds, zero for the others
+        std::vector<linear_bvh_motion_bounds> end_bounds;
+        double time0 = 0, time1 = 0;
+        std::vector<shared_ptr<hittable>> primitives;
+        // Same primitives in SIMD form when the scene only holds spheres,
+        // else as tagged values dispatched without virtual calls
+        sphere_set spheres;
+        primitive_array closed_primitives;
+        aabb box;
+
+        static const int max_prims_in_node = 4;
+        // Primitives a leaf intersects for the price of one, more than one
+        // when the leaves are tested with the SIMD sphere_set
+        int leaf_width = 1;
+        // Traversal stack size, the builder falls back to median splits
+        // deeper than max_sah_depth so the tree never gets deeper than that
+        static const int stack_size = 64;
+        static const int max_sah_depth = 32;
+        // A node interpolates its bounds when the box covering the whole
+        // shutter interval is that much larger than the boxes at its ends
+        static constexpr double motion_area_ratio = 1.3;
+        // Cost of traversing a node relative to intersecting a primitive
+        static constexpr double traversal_cost = 0.125;
+        // Ranges that short are split with the exact sah_split, longer ones
+        // with binned_sah_split
+        static const size_t sah_sweep_range = 16;
+        // Subtrees over that many primitives are built by their own task
+        static const size_t task_range = 4096;
+
+    private:
+        // Build the subtree of entries[start, end) from node slot offset on,
+        // and return its depth. A subtree of n primitives owns 2n-1 slots.
+        int build(std::vector<bvh_build_entry>& entries, size_t start, size_t end, int depth, int offset);
+
+        // Same for the linear bvh over entries sorted by Morton codes, whose
+        // bounds are left to fit_bounds
+        int build_lbvh(const std::vector<uint64_t>& codes, size_t start, size_t end, int depth, int offset);
+
+        // Slots of nodes taken during a build
+        std::vector<char> used_slots;
+
+        // Move the nodes built in slots to the start of the arrays
+        void compact_slots();
+
+        // Bounds of every node from the boxes of the primitives, leaves first
+        void fit_bounds(const std::vector<bvh_build_entry>& entries);
+
+        // Bounds of a node covering box over the shutter interval, start_box
+        // and end_box at its ends, interpolated when that pays off
+        void set_bounds(linear_bvh_node& node, int offset, const aabb& box, const aabb& start_box, const aabb& end_box);
+
+        // Release end_bounds when no node moves
+        void trim_end_bounds();
+
+        // Bounds of node i over the whole shutter interval
+        aabb interval_box(int i) const;
+
+        // SAH cost of the subtree of each node, relative to the node area
+        std::vector<double> subtree_costs() const;
+
+        std::vector<double> build_costs;
+
+        // Closest hit of r in the subtree of node root
+        template <typename T, bool motion>
+        bool traverse(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec, int root = 0) const;
+
+        // Same for the rays of a coherent packet, closest[l] is the t_max of
+        // lane l and then the t of its hit
+        template <typename T, bool motion>
+        int traverse_packet(const ray_packet<T>& packet, T t_min, T* closest, hit_record_t<T>* recs) const;
+
+        // Intersect the primitives of a leaf, closest_so_far is lowered to
+        // the t of the hit
+        template <typename T>
+        bool hit_leaf(const ray_t<T>& r, const linear_bvh_node& node, T t_min, T& closest_so_far, hit_record_t<T>& rec) const;
+
+        int max_depth = 0;
+        // Built with bounds at both ends of the shutter interval
+        bool motion = false;
+};
+
+// Float bounds enclosing the double ones
+inline float round_down(double x) {
+    float f = static_cast<float>(x);
+    return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float round_up(double x) {
+    float f = static_cast<float>(x);
+    return (f < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+linear_bvh::linear_bvh(const hittable_list& list, double time0, double time1, bvh_builder builder)
+    : time0(time0), time1(time1) {
+    if (list.objects.empty()) throw std::invalid_argument("Cannot build a linear_bvh over an empty list");
+
+    auto entries = bvh_build_entries(list.objects, 0, list.objects.size(), time0, time1);
+
+    // Bounds at both ends of the shutter interval when something moves in it
+    motion = time1 > time0 && bvh_entries_move(entries);
+
+    // Leaves over spheres only are intersected through a sphere_set
+    bool only_spheres = true;
+    for (auto & object : list.objects) {
+        if (!std::dynamic_pointer_cast<sphere>(object) && !std::dynamic_pointer_cast<moving_sphere>(object)) {
+            only_spheres = false;
+            break;
+        }
+    }
+    if (only_spheres) leaf_width = simd_lanes(sphere_set_simd_level());
+
+    // A binary tree with at least one primitive per leaf has at most 2n-1
+    // nodes: each subtree gets that many slots, so that the tasks building
+    // subtrees in parallel write to separate parts of the arrays
+    size_t slots = 2 * entries.size() - 1;
+    nodes.resize(slots);
+    used_slots.assign(slots, 0);
+
+    if (builder == bvh_builder::lbvh) {
+        std::vector<uint64_t> codes = bvh_morton_sort(entries);
+
+        #pragma omp parallel
+        #pragma omp single
+        max_depth = build_lbvh(codes, 0, entries.size(), 0, 0);
+
+        compact_slots();
+        fit_bounds(entries);
+    }
+    else {
+        if (motion) end_bounds.resize(slots);
+
+        #pragma omp parallel
+        #pragma omp single
+        max_depth = build(entries, 0, entries.size(), 0, 0);
+
+        compact_slots();
+        trim_end_bounds();
+    }
+
+    primitives.reserve(entries.size());
+    for (auto & entry : entries)
+        primitives.push_back(entry.object);
+
+    for (auto & object : primitives) {
+        if (only_spheres) spheres.add(object);
+        else closed_primitives.add(object);
+    }
+
+    build_costs = subtree_costs();
+}
+
+void linear_bvh::compact_slots() {
+    // The nodes stay in depth-first order
+    std::vector<int> index(nodes.size());
+    int n_nodes = 0;
+    for (size_t i = 0; i < nodes.size(); i++)
+        if (used_slots[i]) index[i] = n_nodes++;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!used_slots[i]) continue;
+        linear_bvh_node node = nodes[i];
+        if (node.n_primitives == 0) node.second_child_offset = index[node.second_child_offset];
+        nodes[index[i]] = node;
+        if (!end_bounds.empty()) end_bounds[index[i]] = end_bounds[i];
+    }
+    nodes.resize(n_nodes);
+    nodes.shrink_to_fit();
+    if (!end_bounds.empty()) end_bounds.resize(n_nodes);
+    std::vector<char>().swap(used_slots);
+}
+
+void linear_bvh::trim_end_bounds() {
+    // Bounds that move too little are not interpolated, without any moving
+    // node the tree is traversed like a static one
+    bool moving_nodes = false;
+    for (auto & node : nodes)
+        if (node.flags & linear_bvh_moving_bounds) moving_nodes = true;
+    if (moving_nodes) end_bounds.shrink_to_fit();
+    else std::vector<linear_bvh_motion_bounds>().swap(end_bounds);
+}
+
+void linear_bvh::set_bounds(
+    linear_bvh_node& node, int offset, const aabb& box, const aabb& start_box, const aabb& end_box) {
+
+    // The static bounds cover the whole interval. Interpolating them costs a
+    // few loads and multiplies per visit, only worth it when the objects move
+    // far compared to the size of the node.
+    bool moving_bounds = motion && box.surface_area()
+        > motion_area_ratio * 0.5 * (start_box.surface_area() + end_box.surface_area());
+
+    const aabb& bounds = moving_bounds ? start_box : box;
+    for (int a = 0; a < 3; a++) {
+        node.bounds_min[a] = round_down(bounds.min()[a]);
+        node.bounds_max[a] = round_up(bounds.max()[a]);
+    }
+    node.flags = moving_bounds ? linear_bvh_moving_bounds : 0;
+
+    if (moving_bounds) {
+        linear_bvh_motion_bounds& e = end_bounds[offset];
+        for (int a = 0; a < 3; a++) {
+            e.delta_min[a] = round_down((double) round_down(end_box.min()[a]) - node.bounds_min[a]);
+            e.delta_max[a] = round_up((double) round_up(end_box.max()[a]) - node.bounds_max[a]);
+        }
+    }
+    else if (motion) {
+        end_bounds[offset] = linear_bvh_motion_bounds();
+    }
+}
+
+int linear_bvh::build(std::vector<bvh_build_entry>& entries, size_t start, size_t end, int depth, int offset) {
+    size_t object_span = end - start;
+    used_slots[offset] = 1;
+
+    bvh_range_bounds bounds = bvh_bounds(entries, start, end);
+    const aabb& node_box = bounds.box;
+    if (depth == 0) box = node_box;
+
+    linear_bvh_node node;
+    set_bounds(node, offset, node_box, bounds.box0, bounds.box1);
+    node.n_primitives = 0;
+    node.axis = 0;
+
+    int axis = 0;
+    size_t split = object_span / 2;
+    bool make_leaf = object_span == 1;
+
+    if (!make_leaf && depth < max_sah_depth) {
+        double split_cost = object_span <= sah_sweep_range
+            ? sah_split(entries, start, end, axis, split)
+            : binned_sah_split(entries, start, end, bounds.centroids, axis, split);
+
+        // Costs relative to one primitive intersection, traversing a node
+        // being about eight times cheaper than intersecting a primitive
+        double leaf_cost = static_cast<double>((object_span + leaf_width - 1) / leaf_width);
+        double area = node_box.surface_area();
+        double node_cost = traversal_cost + (area > 0 ? split_cost / area : leaf_cost);
+
+        make_leaf = object_span <= std::max<size_t>(max_prims_in_node, leaf_width) && leaf_cost <= node_cost;
+    }
+    else if (!make_leaf) {
+        // Too deep for the traversal stack: median split on the largest axis
+        auto extent = node_box.max() - node_box.min();
+        axis = (extent.x() > extent.y() && extent.x() > extent.z()) ? 0 : (extent.y() > extent.z() ? 1 : 2);
+        std::nth_element(entries.begin() + start, entries.begin() + start + split, entries.begin() + end,
+            [axis](const bvh_build_entry& a, const bvh_build_entry& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    if (make_leaf) {
+        node.primitives_offset = static_cast<int32_t>(start);
+        node.n_primitives = static_cast<uint16_t>(object_span);
+        nodes[offset] = node;
+        return depth;
+    }
+
+    // The first child follows its parent, the second one comes after the
+    // 2 * split - 1 slots of the first
+    auto mid = start + split;
+    node.axis = static_cast<uint8_t>(axis);
+    node.second_child_offset = offset + 2 * static_cast<int>(split);
+    nodes[offset] = node;
+
+    int first_depth, second_depth;
+    if (object_span >= task_range) {
+        #pragma omp task default(shared)
+        first_depth = build(entries, start, mid, depth + 1, offset + 1);
+        second_depth = build(entries, mid, end, depth + 1, node.second_child_offset);
+        #pragma omp taskwait
+    }
+    else {
+        first_depth = build(entries, start, mid, depth + 1, offset + 1);
+        second_depth = build(entries, mid, end, depth + 1, node.second_child_offset);
+    }
+    return std::max(first_depth, second_depth);
+}
+
+int linear_bvh::build_lbvh(const std::vector<uint64_t>& codes, size_t start, size_t end, int depth, int offset) {
+    size_t object_span = end - start;
+    used_slots[offset] = 1;
+
+    linear_bvh_node node;
+    node.flags = 0;
+
+    if (object_span <= std::max<size_t>(max_prims_in_node, leaf_width)) {
+        node.primitives_offset = static_cast<int32_t>(start);
+        node.n_primitives = static_cast<uint16_t>(object_span);
+        node.axis = 0;
+        nodes[offset] = node;
+        return depth;
+    }
+
+    // The codes share their bits above the highest one that differs between
+    // the first and the last: the range splits where that bit becomes 1.
+    // Equal codes, or a tree too deep for the traversal stack, are cut in two
+    // halves.
+    int axis = 0;
+    size_t split = object_span / 2;
+    uint64_t differ = codes[start] ^ codes[end - 1];
+    if (differ != 0 && depth < max_sah_depth) {
+        int bit = 63 - __builtin_clzll(differ);
+        auto first_one = std::partition_point(codes.begin() + start, codes.begin() + end,
+            [bit](uint64_t code) { return ((code >> bit) & 1) == 0; });
+        split = static_cast<size_t>(first_one - (codes.begin() + start));
+        axis = morton_axis(bit);
+    }
+
+    auto mid = start + split;
+    node.n_primitives = 0;
+    node.axis = static_cast<uint8_t>(axis);
+    node.second_child_offset = offset + 2 * static_cast<int>(split);
+    nodes[offset] = node;
+
+    int first_depth, second_depth;
+    if (object_span >= task_range) {
+        #pragma omp task default(shared)
+        first_depth = build_lbvh(codes, start, mid, depth + 1, offset + 1);
+        second_depth = build_lbvh(codes, mid, end, depth + 1, node.second_child_offset);
+        #pragma omp taskwait
+    }
+    else {
+        first_depth = build_lbvh(codes, start, mid, depth + 1, offset + 1);
+        second_depth = build_lbvh(codes, mid, end, depth + 1, node.second_child_offset);
+    }
+    return std::max(first_depth, second_depth);
+}
+
+bool linear_bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (nodes.empty()) return false;
+    return end_bounds.empty() ? traverse<double, false>(r, t_min, t_max, rec)
+                              : traverse<double, true>(r, t_min, t_max, rec);
+}
+
+bool linear_bvh::hit(const rayf& r, float t_min, float t_max, hit_recordf& rec) const {
+    if (nodes.empty()) return false;
+    return end_bounds.empty() ? traverse<float, false>(r, t_min, t_max, rec)
+                              : traverse<float, true>(r, t_min, t_max, rec);
+}
+
+template <typename T>
+inline bool linear_bvh::hit_leaf(
+    const ray_t<T>& r, const linear_bvh_node& node, T t_min, T& closest_so_far, hit_record_t<T>& rec) const {
+    RT_STAT(thread_ray_stats().primitive_tests += node.n_primitives);
+    bool hit = spheres.size() > 0
+        ? spheres.hit_range(r, node.primitives_offset, node.n_primitives, t_min, closest_so_far, rec)
+        : closed_primitives.hit_range(r, node.primitives_offset, node.n_primitives, t_min, closest_so_far, rec);
+    if (hit) closest_so_far = rec.t;
+    return hit;
+}
+
+template <typename T, bool motion>
+bool linear_bvh::traverse(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec, int root) const {
+    // Position of the ray in the shutter interval, to interpolate the bounds
+    const T w = motion ? static_cast<T>((r.time() - time0) / (time1 - time0)) : T(0);
+
+    const vec3_t<T> origin = r.origin();
+    const vec3_t<T>& inv_dir = r.inv_direction();
+
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    int to_visit[stack_size];
+    int to_visit_offset = 0;
+    int current = root;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+        RT_STAT(count_node_visit(&node));
+
+        // Bounds at the time of the ray
+        T lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = node.bounds_min[a];
+            hi[a] = node.bounds_max[a];
+        }
+        if (motion && (node.flags & linear_bvh_moving_bounds)) {
+            const linear_bvh_motion_bounds& e = end_bounds[current];
+            for (int a = 0; a < 3; a++) {
+                lo[a] += w * e.delta_min[a];
+                hi[a] += w * e.delta_max[a];
+            }
+        }
+
+        // Slab test against the node bounds, the same as aabb::hit
+        T t0 = t_min, t1 = closest_so_far;
+        for (int a = 0; a < 3; a++) {
+            T t_near = ((r.dir_is_neg(a) ? hi[a] : lo[a]) - origin[a]) * inv_dir[a];
+            T t_far = ((r.dir_is_neg(a) ? lo[a] : hi[a]) - origin[a]) * inv_dir[a] * slab_far_scale<T>();
+            t0 = t_near > t0 ? t_near : t0;
+            t1 = t_far < t1 ? t_far : t1;
+        }
+
+        if (t0 <= t1) {
+            if (node.n_primitives > 0) {
+                if (hit_leaf(r, node, t_min, closest_so_far, rec)) hit_anything = true;
+                if (to_visit_offset == 0) break;
+                current = to_visit[--to_visit_offset];
+            }
+            else if (r.dir_is_neg(node.axis)) {
+                // Ray goes towards the second child: visit it first
+                to_visit[to_visit_offset++] = current + 1;
+                current = node.second_child_offset;
+            }
+            else {
+                to_visit[to_visit_offset++] = node.second_child_offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (to_visit_offset == 0) break;
+            current = to_visit[--to_visit_offset];
+        }
+    }
+
+    return hit_anything;
+}
+
+template <typename T>
+int linear_bvh::hit_packet(const ray_packet<T>& packet, T t_min, T t_max, hit_record_t<T>* recs) const {
+    if (nodes.empty() || packet.active == 0) return 0;
+
+    T closest[ray_packet<T>::size];
+    for (int l = 0; l < ray_packet<T>::size; l++) closest[l] = t_max;
+
+    if (packet.coherent())
+        return end_bounds.empty() ? traverse_packet<T, false>(packet, t_min, closest, recs)
+                                  : traverse_packet<T, true>(packet, t_min, closest, recs);
+
+    // Rays heading different ways share few nodes
+    int hits = 0;
+    for (int l = 0; l < ray_packet<T>::size; l++)
+        if ((packet.active & (1 << l)) && hit(packet.r[l], t_min, t_max, recs[l])) hits |= 1 << l;
+    return hits;
+}
+
+template <typename T, bool motion>
+int linear_bvh::traverse_packet(const ray_packet<T>& packet, T t_min, T* closest, hit_record_t<T>* recs) const {
+    typedef packet_lanes<T> lanes;
+    const int size = ray_packet<T>::size;
+
+    // Lanes of the rays, inactive lanes copy an active ray and are masked out
+    int first = 0;
+    while (!(packet.active & (1 << first))) first++;
+    lanes origin[3], inv_dir[3], w = lanes_set(T(0));
+    for (int l = 0; l < size; l++) {
+        const ray_t<T>& r = packet.r[(packet.active & (1 << l)) ? l : first];
+        for (int a = 0; a < 3; a++) {
+            origin[a].v[l] = r.origin()[a];
+            inv_dir[a].v[l] = r.inv_direction()[a];
+        }
+        if (motion) w.v[l] = static_cast<T>((r.time() - time0) / (time1 - time0));
+    }
+    bool dir_is_neg[3];
+    for (int a = 0; a < 3; a++) dir_is_neg[a] = packet.r[first].dir_is_neg(a);
+    const lanes lanes_t_min = lanes_set(t_min);
+    const lanes far_scale = lanes_set(slab_far_scale<T>());
+
+    int hits = 0;
+    int to_visit[stack_size];
+    int to_visit_offset = 0;
+    int current = 0;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+        RT_STAT(count_node_visit(&node));
+
+        // Slab test of every lane, same operations as traverse
+        lanes t0 = lanes_t_min, t1;
+        for (int l = 0; l < size; l++) t1.v[l] = closest[l];
+        for (int a = 0; a < 3; a++) {
+            lanes lo = lanes_set(static_cast<T>(node.bounds_min[a]));
+            lanes hi = lanes_set(static_cast<T>(node.bounds_max[a]));
+            if (motion && (node.flags & linear_bvh_moving_bounds)) {
+                const linear_bvh_motion_bounds& e = end_bounds[current];
+                lo = lanes_add(lo, lanes_mul(w, lanes_set(static_cast<T>(e.delta_min[a]))));
+                hi = lanes_add(hi, lanes_mul(w, lanes_set(static_cast<T>(e.delta_max[a]))));
+            }
+            if (dir_is_neg[a]) std::swap(lo, hi);
+            lanes t_near = lanes_mul(lanes_sub(lo, origin[a]), inv_dir[a]);
+            lanes t_far = lanes_mul(lanes_mul(lanes_sub(hi, origin[a]), inv_dir[a]), far_scale);
+            t0 = lanes_max(t_near, t0);
+            t1 = lanes_min(t_far, t1);
+        }
+        int crossing = lanes_not_less(t0, t1) & packet.active;
+
+        if (crossing != 0 && (crossing & (crossing - 1)) == 0 && node.n_primitives == 0) {
+            // A single ray left: it goes on alone through the subtrees of the
+            // children, nearest first, this node is already tested and counted
+            int l = 0;
+            while (!(crossing & (1 << l))) l++;
+            int near_child = dir_is_neg[node.axis] ? node.second_child_offset : current + 1;
+            int far_child = dir_is_neg[node.axis] ? current + 1 : node.second_child_offset;
+            for (int child : { near_child, far_child }) {
+                if (traverse<T, motion>(packet.r[l], t_min, closest[l], recs[l], child)) {
+                    hits |= 1 << l;
+                    closest[l] = recs[l].t;
+                }
+            }
+            crossing = 0;
+        }
+
+        if (crossing != 0 && node.n_primitives > 0) {
+            for (int l = 0; l < size; l++)
+                if ((crossing & (1 << l)) && hit_leaf(packet.r[l], node, t_min, closest[l], recs[l]))
+                    hits |= 1 << l;
+        }
+        else if (crossing != 0) {
+            if (dir_is_neg[node.axis]) {
+                to_visit[to_visit_offset++] = current + 1;
+                current = node.second_child_offset;
+            }
+            else {
+                to_visit[to_visit_offset++] = node.second_child_offset;
+                current = current + 1;
+            }
+            continue;
+        }
+
+        if (to_visit_offset == 0) break;
+        current = to_visit[--to_visit_offset];
+    }
+
+    return hits;
+}
+
+bool linear_bvh::bounding_box(double time0, double time1, aabb& output_box) const {
+    if (nodes.empty()) return false;
+    output_box = box;
+    return true;
+}
+
+tinyxml2::XMLElement* linear_bvh::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+    // The hierarchy is rebuilt on load, only its primitives are saved
+    tinyxml2::XMLElement * pElement = xmlDoc.NewElement("List");
+
+    for (auto & item : primitives)
+        pElement->InsertEndChild(item->to_xml(xmlDoc));
+
+    return pElement;
+}
+
+void linear_bvh::refit() {
+    if (nodes.empty()) return;
+
+    auto entries = bvh_build_entries(primitives, 0, primitives.size(), time0, time1);
+    motion = time1 > time0 && bvh_entries_move(entries);
+    fit_bounds(entries);
+
+    // The copies are rebuilt from the moved primitives
+    if (spheres.size() > 0) {
+        spheres = sphere_set();
+        for (auto & object : primitives)
+            spheres.add(object);
+    }
+    else {
+        closed_primitives = primitive_array();
+        for (auto & object : primitives)
+            closed_primitives.add(object);
+    }
+}
+
+void linear_bvh::fit_bounds(const std::vector<bvh_build_entry>& entries) {
+    if (motion) end_bounds.assign(nodes.size(), linear_bvh_motion_bounds());
+    else end_bounds.clear();
+
+    // Children are stored after their parent: walking the array backwards
+    // updates both children of a node before the node itself
+    std::vector<aabb> boxes(nodes.size()), start_boxes(nodes.size()), end_boxes(nodes.size());
+    for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+        linear_bvh_node& node = nodes[i];
+        if (node.n_primitives > 0) {
+            const bvh_build_entry* leaf = &entries[node.primitives_offset];
+            boxes[i] = leaf[0].box;
+            start_boxes[i] = leaf[0].box0;
+            end_boxes[i] = leaf[0].box1;
+            for (int k = 1; k < node.n_primitives; k++) {
+                boxes[i] = surrounding_box(boxes[i], leaf[k].box);
+                start_boxes[i] = surrounding_box(start_boxes[i], leaf[k].box0);
+                end_boxes[i] = surrounding_box(end_boxes[i], leaf[k].box1);
+            }
+        }
+        else {
+            int first = i + 1, second = node.second_child_offset;
+            boxes[i] = surrounding_box(boxes[first], boxes[second]);
+            start_boxes[i] = surrounding_box(start_boxes[first], start_boxes[second]);
+            end_boxes[i] = surrounding_box(end_boxes[first], end_boxes[second]);
+        }
+        set_bounds(node, i, boxes[i], start_boxes[i], end_boxes[i]);
+    }
+    box = boxes[0];
+    trim_end_bounds();
+}
+
+aabb linear_bvh::interval_box(int i) const {
+    const linear_bvh_node& node = nodes[i];
+    point3 lo(node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]);
+    point3 hi(node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]);
+    if (node.flags & linear_bvh_moving_bounds) {
+        const linear_bvh_motion_bounds& e = end_bounds[i];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = fmin(lo[a], lo[a] + e.delta_min[a]);
+            hi[a] = fmax(hi[a], hi[a] + e.delta_max[a]);
+        }
+    }
+    return aabb(lo, hi);
+}
+
+std::vector<double> linear_bvh::subtree_costs() const {
+    // A ray crossing a node crosses its child with the probability of the
+    // ratio of their surface areas. Children are stored after their parent.
+    std::vector<double> costs(nodes.size());
+    std::vector<double> areas(nodes.size());
+    for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+        const linear_bvh_node& node = nodes[i];
+        areas[i] = interval_box(i).surface_area();
+        if (node.n_primitives > 0) {
+            costs[i] = static_cast<double>((node.n_primitives + leaf_width - 1) / leaf_width);
+        }
+        else {
+            int first = i + 1, second = node.second_child_offset;
+            double children = areas[first] * costs[first] + areas[second] * costs[second];
+            costs[i] = traversal_cost + (areas[i] > 0 ? children / areas[i] : costs[first] + costs[second]);
+        }
+    }
+    return costs;
+}
+
+double linear_bvh::sah_degradation() const {
+    if (nodes.empty() || build_costs.size() != nodes.size()) return 1;
+    // Leaves cost the same whatever their bounds, only interior nodes count
+    std::vector<double> costs = subtree_costs();
+    double sum = 0;
+    int interior = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].n_primitives > 0) continue;
+        sum += costs[i] / build_costs[i];
+        interior++;
+    }
+    return interior > 0 ? sum / interior : 1;
+}
+
+linear_bvh_stats linear_bvh::stats() const {
+    linear_bvh_stats s;
+    s.nodes = nodes.size();
+    for (auto & node : nodes) {
+        if (node.n_primitives > 0) s.leaves++;
+        if (node.flags & linear_bvh_moving_bounds) s.moving_nodes++;
+    }
+    s.primitives = primitives.size();
+    s.max_depth = max_depth;
+    s.node_bytes = nodes.size() * sizeof(linear_bvh_node) + end_bounds.size() * sizeof(linear_bvh_motion_bounds);
+    s.primitive_bytes = primitives.size() * sizeof(shared_ptr<hittable>);
+    s.sah_cost = sah_cost();
+    s.sah_degradation = sah_degradation();
+    return s;
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <iostream>
 #include <array>
 #include <cstring>
+#include <string>
+#include <chrono>
 #include <X11/Xlib.h> 
 #include "engine.hpp"
 #include "terminal_gui.hpp"
@@ -15,27 +17,218 @@ unsigned int image_height = static_cast<unsigned int>(image_width / aspect_ratio
 
 int main(int argc, char *argv[])
 { 
-    char file_from[40], file_to[40], file_image_to[40];
-    bool has_origin_file = false, has_dest_file=false, save_image=false;
+    std::string file_from, file_to, file_image_to, file_tile_times_to, file_binary_to, file_heatmap_to;
+    bool has_origin_file = false, has_dest_file=false, save_image=false, bvh_stats=false, convert=false;
+    bool has_seed = false, save_tile_times = false, headless = false;
+    unsigned long long seed = 0;
+    int tile_size = 0, samples_per_pixel = 0, max_depth = 0, roulette_depth = -1;
+    double roulette_probability = 0, roulette_threshold = 0, adaptive_error = 0;
+    bool adaptive = false, progressive = false;
+    heatmap_metric heatmap = heatmap_metric::none, heatmap_kind = heatmap_metric::time;
+    bool set_builder = false;
+    bvh_builder builder = bvh_builder::sah;
+    bool set_precision = false;
+    render_precision precision = render_precision::float64;
+    bool set_integrator = false;
+    render_integrator integrator = render_integrator::megakernel;
+    bool ray_sort = false, primary_packets = false;
+    int min_samples_per_pixel = 0;
     
     if (argc > 1) {
         for (auto i = 1; i < argc; i++) {
             if (strncmp(argv[i], "--from=", 7) == 0) {
-                strcpy(file_from, argv[i]+7);
+                file_from = argv[i]+7;
                 has_origin_file = true;
                 // std::cout << "Geting file from " << argv[i]+7 << std::endl;
             }
             else if (strncmp(argv[i], "--to=", 5) == 0) {
-                strcpy(file_to, argv[i]+5);
+                file_to = argv[i]+5;
                 has_dest_file=true;
             }
+            else if (strncmp(argv[i], "--convert=", 10) == 0) {
+                file_binary_to = argv[i]+10;
+                convert=true;
+            }
             else if (strncmp(argv[i], "--save-image=", 13) == 0) {
-                strcpy(file_image_to, argv[i]+13);
+                file_image_to = argv[i]+13;
                 save_image=true;
             }
+            else if (strncmp(argv[i], "--seed=", 7) == 0) {
+                seed = strtoull(argv[i]+7, nullptr, 10);
+                has_seed = true;
+            }
+            else if (strncmp(argv[i], "--spp=", 6) == 0) {
+                samples_per_pixel = atoi(argv[i]+6);
+            }
+            else if (strcmp(argv[i], "--adaptive") == 0) {
+                adaptive = true;
+            }
+            else if (strcmp(argv[i], "--progressive") == 0) {
+                progressive = true;
+            }
+            else if (strncmp(argv[i], "--min-spp=", 10) == 0) {
+                min_samples_per_pixel = atoi(argv[i]+10);
+            }
+            else if (strncmp(argv[i], "--adaptive-error=", 17) == 0) {
+                adaptive_error = atof(argv[i]+17);
+            }
+            else if (strncmp(argv[i], "--max-depth=", 12) == 0) {
+                max_depth = atoi(argv[i]+12);
+            }
+            else if (strncmp(argv[i], "--roulette-depth=", 17) == 0) {
+                roulette_depth = atoi(argv[i]+17);
+            }
+            else if (strncmp(argv[i], "--roulette-probability=", 23) == 0) {
+                roulette_probability = atof(argv[i]+23);
+            }
+            else if (strncmp(argv[i], "--roulette-threshold=", 21) == 0) {
+                roulette_threshold = atof(argv[i]+21);
+            }
+            else if (strncmp(argv[i], "--tile-size=", 12) == 0) {
+                tile_size = atoi(argv[i]+12);
+            }
+            else if (strncmp(argv[i], "--tile-times=", 13) == 0) {
+                file_tile_times_to = argv[i]+13;
+                save_tile_times = true;
+            }
+            else if (strncmp(argv[i], "--heatmap=", 10) == 0) {
+                file_heatmap_to = argv[i]+10;
+                heatmap = heatmap_kind;
+            }
+            else if (strncmp(argv[i], "--heatmap-metric=", 17) == 0) {
+                if (strcmp(argv[i]+17, "tests") == 0) heatmap_kind = heatmap_metric::tests;
+                else if (strcmp(argv[i]+17, "time") == 0) heatmap_kind = heatmap_metric::time;
+                else {
+                    std::cerr << "Unknown heatmap metric " << argv[i]+17 << " (time or tests)" << std::endl;
+                    return 1;
+                }
+                if (heatmap != heatmap_metric::none) heatmap = heatmap_kind;
+            }
+            else if (strncmp(argv[i], "--bvh-builder=", 14) == 0) {
+                if (!parse_bvh_builder(argv[i]+14, builder)) {
+                    std::cerr << "Unknown bvh builder " << argv[i]+14 << " (sah or lbvh)" << std::endl;
+                    return 1;
+                }
+                set_builder = true;
+            }
+            else if (strncmp(argv[i], "--precision=", 12) == 0) {
+                if (!parse_render_precision(argv[i]+12, precision)) {
+                    std::cerr << "Unknown precision " << argv[i]+12 << " (double or float)" << std::endl;
+                    return 1;
+                }
+                set_precision = true;
+            }
+            else if (strncmp(argv[i], "--integrator=", 13) == 0) {
+                if (!parse_render_integrator(argv[i]+13, integrator)) {
+                    std::cerr << "Unknown integrator " << argv[i]+13 << " (megakernel or wavefront)" << std::endl;
+                    return 1;
+                }
+                set_integrator = true;
+            }
+            else if (strcmp(argv[i], "--ray-sort") == 0) {
+                ray_sort = true;
+            }
+            else if (strcmp(argv[i], "--packets") == 0) {
+                primary_packets = true;
+            }
+            else if (strcmp(argv[i], "--bvh-stats") == 0) {
+                bvh_stats=true;
+            }
+            else if (strcmp(argv[i], "--headless") == 0) {
+                headless=true;
+            }
         }
     } 
+
+    // Command-line values override the ones of the scene
+    auto configure = [&](Engine& engine) {
+        if (has_seed) engine.setSeed(seed);
+        if (tile_size > 0) engine.setTileSize(tile_size);
+        if (samples_per_pixel > 0) engine.setSamplesPerPixel(samples_per_pixel);
+        if (max_depth > 0) engine.setMaxDepth(max_depth);
+        if (roulette_depth >= 0) engine.setRouletteDepth(roulette_depth);
+        if (roulette_probability > 0) engine.setRouletteProbability(roulette_probability);
+        if (roulette_threshold > 0) engine.setRouletteThreshold(roulette_threshold);
+        if (adaptive) engine.setAdaptive(true);
+        if (min_samples_per_pixel > 0) engine.setMinSamplesPerPixel(min_samples_per_pixel);
+        if (adaptive_error > 0) engine.setAdaptiveError(adaptive_error);
+        if (progressive) engine.setProgressive(true);
+        if (heatmap != heatmap_metric::none) engine.setHeatmap(heatmap);
+        if (set_builder) engine.setBvhBuilder(builder);
+        if (set_precision) engine.setPrecision(precision);
+        if (set_integrator) engine.setIntegrator(integrator);
+        if (ray_sort) engine.setRaySort(true);
+        if (primary_packets) engine.setPrimaryPackets(true);
+    };
     
+    if (bvh_stats) {
+        // Print the acceleration structure footprint of the scene and exit
+        Engine statsEngine = has_origin_file ? Engine(file_from.c_str()) : Engine();
+        if (set_builder) statsEngine.setBvhBuilder(builder);
+        std::cout << statsEngine.acceleratorStats();
+        return 0;
+    }
+
+    if (convert) {
+        // Save the scene (XML or binary) in the binary format and exit
+        Engine convertEngine = has_origin_file ? Engine(file_from.c_str()) : Engine();
+        configure(convertEngine);
+        convertEngine.saveBinaryScene(file_binary_to.c_str());
+        return 0;
+    }
+
+    if (headless) {
+        // Batch render: no window, no terminal interface, timings on stdout
+        auto load_start = std::chrono::steady_clock::now();
+        Engine batchEngine = has_origin_file ? Engine(file_from.c_str()) : Engine();
+        configure(batchEngine);
+        // Modes of the scene or of the command line the render falls back from
+        std::cerr << batchEngine.ignoredSettings();
+        std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+
+        batchEngine.setToWork();
+        auto render_start = std::chrono::steady_clock::now();
+        batchEngine.createImage();
+        std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - render_start;
+
+        double samples = batchEngine.getAverageSamplesPerPixel()
+                         * batchEngine.getImgWidth() * batchEngine.getImgHeight();
+
+        std::cout << "scene: " << (has_origin_file ? file_from : std::string("default")) << '\n'
+                  << "image: " << batchEngine.getImgWidth() << 'x' << batchEngine.getImgHeight() << '\n'
+                  << "spp: " << batchEngine.getSamplesPerPixel() << '\n'
+                  << "average_spp: " << batchEngine.getAverageSamplesPerPixel() << '\n'
+                  << "threads: " << omp_get_max_threads() << '\n'
+                  << "load_seconds: " << load_time.count() << '\n'
+                  << "render_seconds: " << render_time.count() << '\n'
+                  << "samples_per_second: " << samples / render_time.count() << '\n';
+        if (RT_STATS_ENABLED) {
+            std::cout << "rays_per_second: " << batchEngine.getRayStats().rays() / render_time.count() << '\n'
+                      << batchEngine.getRayStats();
+        }
+        std::cout << std::flush;
+
+        if (save_image && !batchEngine.saveImage(file_image_to.c_str())) {
+            std::cerr << "Could not save image to " << file_image_to << std::endl;
+            return 1;
+        }
+        if (has_dest_file) {
+            batchEngine.saveXmlDocument(file_to.c_str());
+        }
+        if (save_tile_times) {
+            batchEngine.saveTileTimings(file_tile_times_to.c_str());
+        }
+        if (heatmap != heatmap_metric::none) {
+            std::cout << "heatmap_scale: " << batchEngine.getHeatmapScale()
+                      << (heatmap == heatmap_metric::time ? " seconds" : " tests") << std::endl;
+            if (!batchEngine.saveHeatmap(file_heatmap_to.c_str())) {
+                std::cerr << "Could not save heatmap to " << file_heatmap_to << std::endl;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
     XInitThreads();
     
     // window.setActive(false);
@@ -43,11 +236,13 @@ int main(int argc, char *argv[])
     //Engine rtEngine(texture, image_width, image_height);
     Engine rtEngine;
     if (has_origin_file) {
-        rtEngine = Engine(file_from);
+        rtEngine = Engine(file_from.c_str());
     } 
     else {
         rtEngine = Engine();
     }
+    configure(rtEngine);
+    std::cerr << rtEngine.ignoredSettings();
     
     sf::Sprite sprite(rtEngine.getTexture());
 
@@ -85,8 +280,12 @@ int main(int argc, char *argv[])
         
         if (rtEngine.isWorking()) {
             window.clear();
-            window.setVisible(false);
+            // A progressive render stays on screen while its passes refine it
+            if (!rtEngine.isProgressive() || !rtEngine.hasImageReady())
+                window.setVisible(false);
             rtEngine.renderImage();
+            // The texture is (re)created at the size of the rendered image
+            sprite.setTexture(rtEngine.getTexture(), true);
             window.setVisible(true);
             window.draw(sprite);
             window.display();
@@ -96,11 +295,17 @@ int main(int argc, char *argv[])
 
     if (has_dest_file) {
         // std::cout << "Saving file to " << file_to << std::endl;
-        rtEngine.saveXmlDocument(file_to);
+        rtEngine.saveXmlDocument(file_to.c_str());
     }
     if (save_image) {
         // std::cout << "Saving image to " << file_image_to << std::endl;
-        rtEngine.getTexture().copyToImage().saveToFile(file_image_to);
+        rtEngine.saveImage(file_image_to.c_str());
+    }
+    if (save_tile_times) {
+        rtEngine.saveTileTimings(file_tile_times_to.c_str());
+    }
+    if (heatmap != heatmap_metric::none) {
+        rtEngine.saveHeatmap(file_heatmap_to.c_str());
     }
 
     terminal.close();
@@ -3,24 +3,74 @@
 
 #include "rt.hpp"
 
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "../include/tinyxml2.h"
 
-struct hit_record;
+template <typename T> struct hit_record_t;
+using hit_record = hit_record_t<double>;
+using hit_recordf = hit_record_t<float>;
+
+// Value of a material: two materials with the same key scatter identically
+struct material_key {
+    int type;
+    double albedo[3];
+    double fuzz;
+    double ir;
+
+    bool operator==(const material_key& other) const {
+        return type == other.type && albedo[0] == other.albedo[0] && albedo[1] == other.albedo[1]
+               && albedo[2] == other.albedo[2] && fuzz == other.fuzz && ir == other.ir;
+    }
+};
+
+struct material_key_hash {
+    size_t operator()(const material_key& k) const {
+        size_t h = std::hash<int>()(k.type);
+        for (double v : {k.albedo[0], k.albedo[1], k.albedo[2], k.fuzz, k.ir})
+            h ^= std::hash<double>()(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+// Materials of the engine, scattered by scatter_material without virtual call
+enum class material_kind : uint8_t { lambertian, metal, dielectric, other };
 
 class material {
     public:
+        material() {}
+
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const = 0;        
+        // Same in single precision, the subclasses instantiate one kernel
+        // template for both
+        virtual bool scatter(
+            const rayf& r_in, const hit_recordf& rec, colorf& attenuation, rayf& scattered
+        ) const = 0;
         virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const {return nullptr;};
+        virtual material_key key() const = 0;
         static std::shared_ptr<material> material_from_xml(tinyxml2::XMLElement* pElement);
+
+        // Set by the materials of the engine only, which are final so that
+        // the kind always names the class of the object. Constant, as
+        // scatter_material casts to the class it names.
+        const material_kind kind = material_kind::other;
+
+    protected:
+        explicit material(material_kind k) : kind(k) {}
 };
 
-class lambertian : public material {
+class lambertian final : public material {
     public:
-        lambertian(const color& a) : albedo(a) {}
+        lambertian(const color& a) : material(material_kind::lambertian), albedo(a) {}
 
-        lambertian(tinyxml2::XMLElement* pElement) {
+        lambertian(tinyxml2::XMLElement* pElement) : material(material_kind::lambertian) {
             tinyxml2::XMLElement * color = pElement->FirstChildElement("Color");
 
             albedo = vec3(color->DoubleAttribute("r"), color->DoubleAttribute("g"), color->DoubleAttribute("b"));
@@ -29,14 +79,27 @@ class lambertian : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
-            auto scatter_direction = rec.normal + random_unit_vector();
+            return scatter_kernel(r_in, rec, attenuation, scattered);
+        }
+
+        virtual bool scatter(
+            const rayf& r_in, const hit_recordf& rec, colorf& attenuation, rayf& scattered
+        ) const override {
+            return scatter_kernel(r_in, rec, attenuation, scattered);
+        }
+
+        template <typename T>
+        bool scatter_kernel(
+            const ray_t<T>& r_in, const hit_record_t<T>& rec, vec3_t<T>& attenuation, ray_t<T>& scattered
+        ) const {
+            auto scatter_direction = rec.normal + random_unit_vector<T>();
             
             // Catch degenerate scatter direction
             if (scatter_direction.near_zero())
                 scatter_direction = rec.normal;
                 
-            scattered = ray(rec.p, scatter_direction, r_in.time());
-            attenuation = albedo;
+            scattered = ray_t<T>(rec.p, scatter_direction, r_in.time());
+            attenuation = vec3_t<T>(albedo);
             return true;
         }
 
@@ -53,15 +116,19 @@ class lambertian : public material {
             return pElement;
         }
 
+        virtual material_key key() const override {
+            return material_key{ 0, { albedo.x(), albedo.y(), albedo.z() }, 0.0, 0.0 };
+        }
+
     public:
         color albedo;
 };
 
-class metal : public material {
+class metal final : public material {
     public:
-        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+        metal(const color& a, double f) : material(material_kind::metal), albedo(a), fuzz(f < 1 ? f : 1) {}
 
-        metal(tinyxml2::XMLElement* pElement) {
+        metal(tinyxml2::XMLElement* pElement) : material(material_kind::metal) {
             fuzz = pElement->DoubleAttribute("Fuzz");
             tinyxml2::XMLElement * color = pElement->FirstChildElement("Color");
             albedo = vec3(color->DoubleAttribute("r"), color->DoubleAttribute("g"), color->DoubleAttribute("b"));
@@ -70,9 +137,22 @@ class metal : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
-            vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(), r_in.time());
-            attenuation = albedo;
+            return scatter_kernel(r_in, rec, attenuation, scattered);
+        }
+
+        virtual bool scatter(
+            const rayf& r_in, const hit_recordf& rec, colorf& attenuation, rayf& scattered
+        ) const override {
+            return scatter_kernel(r_in, rec, attenuation, scattered);
+        }
+
+        template <typename T>
+        bool scatter_kernel(
+            const ray_t<T>& r_in, const hit_record_t<T>& rec, vec3_t<T>& attenuation, ray_t<T>& scattered
+        ) const {
+            vec3_t<T> reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+            scattered = ray_t<T>(rec.p, reflected + static_cast<T>(fuzz)*random_in_unit_sphere<T>(), r_in.time());
+            attenuation = vec3_t<T>(albedo);
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
@@ -91,38 +171,55 @@ class metal : public material {
             return pElement;
         }
 
+        virtual material_key key() const override {
+            return material_key{ 1, { albedo.x(), albedo.y(), albedo.z() }, fuzz, 0.0 };
+        }
+
     public:
         color albedo;
         double fuzz;
 };
 
-class dielectric : public material {
+class dielectric final : public material {
     public:
-        dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+        dielectric(double index_of_refraction) : material(material_kind::dielectric), ir(index_of_refraction) {}
 
-        dielectric(tinyxml2::XMLElement* pElement) {
+        dielectric(tinyxml2::XMLElement* pElement) : material(material_kind::dielectric) {
             ir = pElement->DoubleAttribute("Ir");
         }
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
-            attenuation = color(1.0, 1.0, 1.0);
-            double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
+            return scatter_kernel(r_in, rec, attenuation, scattered);
+        }
+
+        virtual bool scatter(
+            const rayf& r_in, const hit_recordf& rec, colorf& attenuation, rayf& scattered
+        ) const override {
+            return scatter_kernel(r_in, rec, attenuation, scattered);
+        }
 
-            vec3 unit_direction = unit_vector(r_in.direction());
-            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+        template <typename T>
+        bool scatter_kernel(
+            const ray_t<T>& r_in, const hit_record_t<T>& rec, vec3_t<T>& attenuation, ray_t<T>& scattered
+        ) const {
+            attenuation = vec3_t<T>(1.0, 1.0, 1.0);
+            T refraction_ratio = static_cast<T>(rec.front_face ? (1.0/ir) : ir);
 
-            bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-            vec3 direction;
+            vec3_t<T> unit_direction = unit_vector(r_in.direction());
+            T cos_theta = std::min(dot(-unit_direction, rec.normal), T(1));
+            T sin_theta = sqrt(1 - cos_theta*cos_theta);
+
+            bool cannot_refract = refraction_ratio * sin_theta > 1;
+            vec3_t<T> direction;
 
             if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
                 direction = reflect(unit_direction, rec.normal);
             else
                 direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-            scattered = ray(rec.p, direction, r_in.time());
+            scattered = ray_t<T>(rec.p, direction, r_in.time());
             return true;
         }
 
@@ -134,11 +231,16 @@ class dielectric : public material {
             return pElement;
         }
 
+        virtual material_key key() const override {
+            return material_key{ 2, { 0.0, 0.0, 0.0 }, 0.0, ir };
+        }
+
     public:
         double ir; // Index of Refraction
         
 	private:
-		static double reflectance(double cosine, double ref_idx) {
+		template <typename T>
+		static T reflectance(T cosine, T ref_idx) {
 			// Use Schlick's approximation for reflectance.
 			auto r0 = (1-ref_idx) / (1+ref_idx);
 			r0 = r0*r0;
@@ -146,6 +248,25 @@ class dielectric : public material {
 		}
 };
 
+// Closed-world scatter: a switch on the kind of m inlines the kernel of the
+// materials of the engine into the caller, other materials go through the
+// virtual scatter
+template <typename T>
+inline bool scatter_material(
+    const material& m, const ray_t<T>& r_in, const hit_record_t<T>& rec, vec3_t<T>& attenuation, ray_t<T>& scattered
+) {
+    switch (m.kind) {
+        case material_kind::lambertian:
+            return static_cast<const lambertian&>(m).scatter_kernel(r_in, rec, attenuation, scattered);
+        case material_kind::metal:
+            return static_cast<const metal&>(m).scatter_kernel(r_in, rec, attenuation, scattered);
+        case material_kind::dielectric:
+            return static_cast<const dielectric&>(m).scatter_kernel(r_in, rec, attenuation, scattered);
+        default:
+            return m.scatter(r_in, rec, attenuation, scattered);
+    }
+}
+
 std::shared_ptr<material> material::material_from_xml(tinyxml2::XMLElement* pElement) {
     tinyxml2::XMLElement* matElement = pElement->FirstChildElement();
     if (strcmp(matElement->Name(), "Lambertian") == 0) {
@@ -162,4 +283,104 @@ std::shared_ptr<material> material::material_from_xml(tinyxml2::XMLElement* pEle
     }
 } 
 
+// Set of distinct materials: equal materials are interned into one shared
+// instance, and each gets the id used by the <Materials> section of a scene.
+class material_table {
+    public:
+        // The material of the table equal to m, m itself if it is new
+        std::shared_ptr<material> intern(const std::shared_ptr<material>& m);
+
+        // Index of the material equal to m, interning it
+        int id(const std::shared_ptr<material>& m);
+
+        const std::vector<std::shared_ptr<material>>& materials() const { return table; }
+
+        /* Read a <Materials> section, its Id attributes name the materials
+           referenced by <Material Id="..."/> elements */
+        void from_xml(tinyxml2::XMLElement* pElement);
+
+        // <Materials> section with every material of the table
+        tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const;
+
+        // Material of a <Material> element, given inline or by Id
+        std::shared_ptr<material> material_from_xml(tinyxml2::XMLElement* pElement);
+
+        // <Material Id="..."/> element referencing m
+        tinyxml2::XMLElement* reference_xml(tinyxml2::XMLDocument& xmlDoc, const std::shared_ptr<material>& m);
+
+    private:
+        std::vector<std::shared_ptr<material>> table;
+        std::unordered_map<material_key, int, material_key_hash> by_key;
+        // Only the materials of table, which stay alive with it
+        std::unordered_map<const material*, int> by_pointer;
+        std::unordered_map<int, std::shared_ptr<material>> by_file_id;
+};
+
+int material_table::id(const std::shared_ptr<material>& m) {
+    if (m == nullptr) throw std::invalid_argument("Cannot intern a null material");
+
+    auto known = by_pointer.find(m.get());
+    if (known != by_pointer.end()) return known->second;
+
+    // An equal material is not kept, nor is its address: once it is freed
+    // the address can be that of another material
+    material_key key = m->key();
+    auto equal = by_key.find(key);
+    if (equal != by_key.end()) return equal->second;
+
+    int index = static_cast<int>(table.size());
+    table.push_back(m);
+    by_key[key] = index;
+    by_pointer[m.get()] = index;
+    return index;
+}
+
+std::shared_ptr<material> material_table::intern(const std::shared_ptr<material>& m) {
+    return table[id(m)];
+}
+
+void material_table::from_xml(tinyxml2::XMLElement* pElement) {
+    for (tinyxml2::XMLElement* matElement = pElement->FirstChildElement("Material");
+         matElement != nullptr; matElement = matElement->NextSiblingElement("Material")) {
+        int file_id;
+        if (matElement->QueryIntAttribute("Id", &file_id) != tinyxml2::XML_SUCCESS)
+            throw std::invalid_argument("Material of the Materials section without Id");
+        by_file_id[file_id] = intern(material::material_from_xml(matElement));
+    }
+}
+
+tinyxml2::XMLElement* material_table::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+    tinyxml2::XMLElement * pElement = xmlDoc.NewElement("Materials");
+
+    for (size_t i = 0; i < table.size(); i++) {
+        tinyxml2::XMLElement* material_xml = xmlDoc.NewElement("Material");
+        material_xml->SetAttribute("Id", static_cast<int>(i));
+        material_xml->InsertEndChild(table[i]->to_xml(xmlDoc));
+        pElement->InsertEndChild(material_xml);
+    }
+
+    return pElement;
+}
+
+std::shared_ptr<material> material_table::material_from_xml(tinyxml2::XMLElement* pElement) {
+    if (pElement == nullptr) throw std::invalid_argument("Object without material");
+
+    int file_id;
+    if (pElement->FirstChildElement() == nullptr
+        && pElement->QueryIntAttribute("Id", &file_id) == tinyxml2::XML_SUCCESS) {
+        auto found = by_file_id.find(file_id);
+        if (found == by_file_id.end())
+            throw std::invalid_argument("Material " + std::to_string(file_id) + " isn't in the Materials section");
+        return found->second;
+    }
+
+    return intern(material::material_from_xml(pElement));
+}
+
+tinyxml2::XMLElement* material_table::reference_xml(tinyxml2::XMLDocument& xmlDoc, const std::shared_ptr<material>& m) {
+    tinyxml2::XMLElement* material_xml = xmlDoc.NewElement("Material");
+    material_xml->SetAttribute("Id", id(m));
+    return material_xml;
+}
+
 #endif
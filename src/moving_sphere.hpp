@@ -4,6 +4,7 @@
 #include "rt.hpp"
 #include "aabb.hpp"
 #include "hittable.hpp"
+#include "sphere.hpp"
 
 #include "../include/tinyxml2.h"
 
@@ -16,11 +17,14 @@ class moving_sphere : public hittable {
             point3 cen0, point3 cen1, double _time0, double _time1, double r, shared_ptr<material> m)
             : center0(cen0), center1(cen1), time0(_time0), time1(_time1), radius(r), mat_ptr(m)
         {};
-        moving_sphere(tinyxml2::XMLElement* pElement);
+        moving_sphere(tinyxml2::XMLElement* pElement, material_table& materials);
 
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit(
+            const rayf& r, float t_min, float t_max, hit_recordf& rec) const override;
+
 		virtual bool bounding_box(
             double _time0, double _time1, aabb& output_box) const override;
             
@@ -28,14 +32,23 @@ class moving_sphere : public hittable {
 
         virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const override;
 
+        virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc, material_table& materials) const override;
+
     public:
         point3 center0, center1;
         double time0, time1;
         double radius;
         shared_ptr<material> mat_ptr;
+
+    private:
+        template <typename T>
+        bool hit_kernel(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) const;
+
+        // Element without its material
+        tinyxml2::XMLElement* geometry_xml(tinyxml2::XMLDocument& xmlDoc) const;
 };
 
-moving_sphere::moving_sphere(tinyxml2::XMLElement* pElement) {
+moving_sphere::moving_sphere(tinyxml2::XMLElement* pElement, material_table& materials) {
     radius = pElement->DoubleAttribute("Radius");
     time0 = pElement->DoubleAttribute("Time0");
     time1 = pElement->DoubleAttribute("Time1");
@@ -46,7 +59,7 @@ moving_sphere::moving_sphere(tinyxml2::XMLElement* pElement) {
     tinyxml2::XMLElement* center1_xml = pElement->FirstChildElement("Center1");
     center1 = point3(center1_xml->DoubleAttribute("x"), center1_xml->DoubleAttribute("y"), center1_xml->DoubleAttribute("z"));
 
-    mat_ptr = material::material_from_xml(pElement->FirstChildElement("Material"));
+    mat_ptr = materials.material_from_xml(pElement->FirstChildElement("Material"));
 }
 
 point3 moving_sphere::center(double time) const {
@@ -54,28 +67,26 @@ point3 moving_sphere::center(double time) const {
 }
 
 bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center(r.time());
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius*radius;
-
-    auto discriminant = half_b*half_b - a*c;
-    if (discriminant < 0) return false;
-    auto sqrtd = sqrt(discriminant);
-
-    // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
-    if (root < t_min || t_max < root) {
-        root = (-half_b + sqrtd) / a;
-        if (root < t_min || t_max < root)
-            return false;
-    }
+    return hit_kernel(r, t_min, t_max, rec);
+}
+
+bool moving_sphere::hit(const rayf& r, float t_min, float t_max, hit_recordf& rec) const {
+    return hit_kernel(r, t_min, t_max, rec);
+}
+
+template <typename T>
+bool moving_sphere::hit_kernel(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) const {
+    const vec3_t<T> cen(center(r.time()));
+    const T rad = static_cast<T>(radius);
+
+    T root;
+    if (!sphere_root(r, cen, rad, t_min, t_max, root)) return false;
 
     rec.t = root;
     rec.p = r.at(rec.t);
-    auto outward_normal = (rec.p - center(r.time())) / radius;
+    auto outward_normal = (rec.p - cen) / rad;
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
 
     return true;
 }
@@ -91,7 +102,7 @@ bool moving_sphere::bounding_box(double _time0, double _time1, aabb& output_box)
     return true;
 }
 
-tinyxml2::XMLElement* moving_sphere::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+tinyxml2::XMLElement* moving_sphere::geometry_xml(tinyxml2::XMLDocument& xmlDoc) const {
     tinyxml2::XMLElement * pElement = xmlDoc.NewElement("Moving_Sphere");
     
     pElement->SetAttribute("Radius", radius);
@@ -114,6 +125,18 @@ tinyxml2::XMLElement* moving_sphere::to_xml(tinyxml2::XMLDocument& xmlDoc) const
 
     pElement->InsertEndChild(center1_xml);
 
+    return pElement;
+}
+
+tinyxml2::XMLElement* moving_sphere::to_xml(tinyxml2::XMLDocument& xmlDoc, material_table& materials) const {
+    tinyxml2::XMLElement * pElement = geometry_xml(xmlDoc);
+    pElement->InsertEndChild(materials.reference_xml(xmlDoc, mat_ptr));
+    return pElement;
+}
+
+tinyxml2::XMLElement* moving_sphere::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+    tinyxml2::XMLElement * pElement = geometry_xml(xmlDoc);
+
     tinyxml2::XMLElement* material_xml = xmlDoc.NewElement("Material");
     tinyxml2::XMLElement* materialElement = mat_ptr->to_xml(xmlDoc);
     
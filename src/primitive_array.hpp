@@ -0,0 +1,178 @@
+#ifndef PRIMITIVE_ARRAY_H
+#define PRIMITIVE_ARRAY_H
+
+#include "rt.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "sphere.hpp"
+#include "moving_sphere.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include "../include/tinyxml2.h"
+
+enum class primitive_kind : uint8_t { sphere, moving_sphere, other };
+
+struct closed_sphere {
+    double center[3];
+    double radius;
+};
+
+struct closed_moving_sphere {
+    double center0[3], center1[3];
+    double time0, time1;
+    double radius;
+};
+
+// Primitive stored by value and tagged with its kind: the objects known to
+// the engine are intersected through a switch that inlines their kernel,
+// any other hittable through its virtual hit.
+struct closed_primitive {
+    primitive_kind kind;
+    const material* mat_ptr;
+    union {
+        closed_sphere still;
+        closed_moving_sphere moving;
+        const hittable* other;
+    };
+};
+
+// Same result as sphere::hit, moving_sphere::hit or the hit of the object
+template <typename T>
+inline bool hit_primitive(const closed_primitive& p, const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) {
+    vec3_t<T> center;
+    T radius;
+
+    switch (p.kind) {
+        case primitive_kind::sphere:
+            center = vec3_t<T>(point3(p.still.center[0], p.still.center[1], p.still.center[2]));
+            radius = static_cast<T>(p.still.radius);
+            break;
+        case primitive_kind::moving_sphere: {
+            const closed_moving_sphere& m = p.moving;
+            point3 center0(m.center0[0], m.center0[1], m.center0[2]);
+            point3 center1(m.center1[0], m.center1[1], m.center1[2]);
+            center = vec3_t<T>(center0 + ((r.time() - m.time0) / (m.time1 - m.time0))*(center1 - center0));
+            radius = static_cast<T>(m.radius);
+            break;
+        }
+        default:
+            return p.other->hit(r, t_min, t_max, rec);
+    }
+
+    T root;
+    if (!sphere_root(r, center, radius, t_min, t_max, root)) return false;
+
+    rec.t = root;
+    rec.p = r.at(rec.t);
+    vec3_t<T> outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = p.mat_ptr;
+
+    return true;
+}
+
+// Contiguous array of closed_primitive, the leaves of a linear_bvh over a
+// scene that does not only hold spheres (those go to a sphere_set)
+class primitive_array : public hittable {
+    public:
+        primitive_array() {}
+
+        void add(const shared_ptr<hittable>& object);
+
+        size_t size() const { return items.size(); }
+
+        // Intersect the primitives [first, first + count)
+        template <typename T>
+        bool hit_range(
+            const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const;
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_range(r, 0, size(), t_min, t_max, rec);
+        }
+
+        virtual bool hit(
+            const rayf& r, float t_min, float t_max, hit_recordf& rec) const override {
+            return hit_range(r, 0, size(), t_min, t_max, rec);
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+        virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const override;
+
+    public:
+        std::vector<closed_primitive> items;
+
+        // Owning references, the array shares the objects of the scene
+        std::vector<shared_ptr<hittable>> sources;
+};
+
+void primitive_array::add(const shared_ptr<hittable>& object) {
+    closed_primitive p;
+
+    if (auto sp = std::dynamic_pointer_cast<sphere>(object)) {
+        p.kind = primitive_kind::sphere;
+        p.mat_ptr = sp->mat_ptr.get();
+        for (int a = 0; a < 3; a++) p.still.center[a] = sp->center[a];
+        p.still.radius = sp->radius;
+    }
+    else if (auto ms = std::dynamic_pointer_cast<moving_sphere>(object)) {
+        p.kind = primitive_kind::moving_sphere;
+        p.mat_ptr = ms->mat_ptr.get();
+        for (int a = 0; a < 3; a++) {
+            p.moving.center0[a] = ms->center0[a];
+            p.moving.center1[a] = ms->center1[a];
+        }
+        p.moving.time0 = ms->time0;
+        p.moving.time1 = ms->time1;
+        p.moving.radius = ms->radius;
+    }
+    else {
+        p.kind = primitive_kind::other;
+        p.mat_ptr = nullptr;
+        p.other = object.get();
+    }
+
+    items.push_back(p);
+    sources.push_back(object);
+}
+
+template <typename T>
+bool primitive_array::hit_range(
+    const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const {
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    for (size_t i = first; i < first + count; i++) {
+        if (hit_primitive(items[i], r, t_min, closest_so_far, rec)) {
+            hit_anything = true;
+            closest_so_far = rec.t;
+        }
+    }
+
+    return hit_anything;
+}
+
+bool primitive_array::bounding_box(double _time0, double _time1, aabb& output_box) const {
+    if (sources.empty()) return false;
+
+    aabb temp_box;
+    for (size_t i = 0; i < sources.size(); i++) {
+        sources[i]->bounding_box(_time0, _time1, temp_box);
+        output_box = i == 0 ? temp_box : surrounding_box(output_box, temp_box);
+    }
+    return true;
+}
+
+tinyxml2::XMLElement* primitive_array::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+    tinyxml2::XMLElement * pElement = xmlDoc.NewElement("List");
+
+    for (auto & item : sources)
+        pElement->InsertEndChild(item->to_xml(xmlDoc));
+
+    return pElement;
+}
+
+#endif
@@ -4,25 +4,56 @@
 #include "vec3.hpp"
 #include "hittable_list.hpp"
 
-class ray {
+// The inverse of the direction and its signs are computed once per ray, for
+// the slab tests of every box the ray meets. A zero component gives an
+// infinite inverse, which the slab tests handle.
+template <typename T>
+class ray_t {
     public:
-        ray() {}
-        ray(const point3& origin, const vec3& direction, double time = 0.0)
+        ray_t() {}
+        ray_t(const vec3_t<T>& origin, const vec3_t<T>& direction, T time = 0.0)
             : orig(origin), dir(direction), tm(time)
-        {}
+        {
+            set_inverse();
+        }
+
+        // Same ray in another precision
+        template <typename U>
+        explicit ray_t(const ray_t<U>& r)
+            : orig(r.origin()), dir(r.direction()), tm(static_cast<T>(r.time()))
+        {
+            set_inverse();
+        }
 
-        point3 origin() const  { return orig; }
-        vec3 direction() const { return dir; }
-        double time() const    { return tm; }
+        vec3_t<T> origin() const  { return orig; }
+        vec3_t<T> direction() const { return dir; }
+        T time() const    { return tm; }
 
-        point3 at(double t) const {
+        const vec3_t<T>& inv_direction() const { return inv_dir; }
+        // 1 where the direction is negative: the slab of axis a is entered
+        // through the max side of the box
+        int dir_is_neg(int a) const { return sign[a]; }
+
+        vec3_t<T> at(T t) const {
             return orig + t*dir;
         }
 
-    public:
-        point3 orig;
-        vec3 dir;
-        double tm;
+    private:
+        // Read only through the accessors, the inverse stays that of dir
+        vec3_t<T> orig;
+        vec3_t<T> dir;
+        T tm;
+
+        void set_inverse() {
+            inv_dir = vec3_t<T>(T(1) / dir.x(), T(1) / dir.y(), T(1) / dir.z());
+            for (int a = 0; a < 3; a++) sign[a] = inv_dir[a] < 0;
+        }
+
+        vec3_t<T> inv_dir;
+        int sign[3];
 };
 
+using ray = ray_t<double>;
+using rayf = ray_t<float>;
+
 #endif
@@ -0,0 +1,147 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RAY_PACKET_X86
+#include <immintrin.h>
+#endif
+
+// Camera rays of a 2x2 block of pixels, traced together through the nodes of
+// a linear_bvh. Lanes go row by row, active has a bit per lane holding a ray
+// (a block on the edge of a tile has fewer than 4 pixels).
+template <typename T>
+struct ray_packet {
+    static const int size = 4;
+
+    ray_t<T> r[size];
+    int active = 0;
+
+    // Directions of all the active rays in the same octant: the packet
+    // visits the children of a node in one order for all its rays
+    bool coherent() const;
+};
+
+template <typename T>
+bool ray_packet<T>::coherent() const {
+    int octant = -1;
+    for (int l = 0; l < size; l++) {
+        if (!(active & (1 << l))) continue;
+        const vec3_t<T>& d = r[l].direction();
+        int o = (d.x() < 0) | (d.y() < 0) << 1 | (d.z() < 0) << 2;
+        if (octant >= 0 && o != octant) return false;
+        octant = o;
+    }
+    return true;
+}
+
+// One value per lane of a packet, in one SSE register for float and two for
+// double. The operations round like their scalar versions, so that a packet
+// culls exactly the nodes its rays would cull one by one.
+template <typename T>
+struct packet_lanes {
+    T v[ray_packet<T>::size];
+};
+
+template <typename T>
+inline packet_lanes<T> lanes_set(T x) {
+    packet_lanes<T> a;
+    for (int l = 0; l < ray_packet<T>::size; l++) a.v[l] = x;
+    return a;
+}
+
+// Scalar versions, for the other instruction sets
+template <typename T>
+inline packet_lanes<T> lanes_add(const packet_lanes<T>& a, const packet_lanes<T>& b) {
+    packet_lanes<T> c;
+    for (int l = 0; l < ray_packet<T>::size; l++) c.v[l] = a.v[l] + b.v[l];
+    return c;
+}
+
+template <typename T>
+inline packet_lanes<T> lanes_sub(const packet_lanes<T>& a, const packet_lanes<T>& b) {
+    packet_lanes<T> c;
+    for (int l = 0; l < ray_packet<T>::size; l++) c.v[l] = a.v[l] - b.v[l];
+    return c;
+}
+
+template <typename T>
+inline packet_lanes<T> lanes_mul(const packet_lanes<T>& a, const packet_lanes<T>& b) {
+    packet_lanes<T> c;
+    for (int l = 0; l < ray_packet<T>::size; l++) c.v[l] = a.v[l] * b.v[l];
+    return c;
+}
+
+// a > b ? a : b and a < b ? a : b, b when a is NaN
+template <typename T>
+inline packet_lanes<T> lanes_max(const packet_lanes<T>& a, const packet_lanes<T>& b) {
+    packet_lanes<T> c;
+    for (int l = 0; l < ray_packet<T>::size; l++) c.v[l] = a.v[l] > b.v[l] ? a.v[l] : b.v[l];
+    return c;
+}
+
+template <typename T>
+inline packet_lanes<T> lanes_min(const packet_lanes<T>& a, const packet_lanes<T>& b) {
+    packet_lanes<T> c;
+    for (int l = 0; l < ray_packet<T>::size; l++) c.v[l] = a.v[l] < b.v[l] ? a.v[l] : b.v[l];
+    return c;
+}
+
+// Bit l set when !(b < a) in lane l
+template <typename T>
+inline int lanes_not_less(const packet_lanes<T>& a, const packet_lanes<T>& b) {
+    int mask = 0;
+    for (int l = 0; l < ray_packet<T>::size; l++) mask |= !(b.v[l] < a.v[l]) << l;
+    return mask;
+}
+
+#ifdef RAY_PACKET_X86
+
+// _mm_max_ps(a, b) and _mm_min_ps(a, b) return b when a is NaN, as the
+// scalar versions do
+#define RAY_PACKET_LANES_PS(name, op) \
+    template <> \
+    inline packet_lanes<float> name(const packet_lanes<float>& a, const packet_lanes<float>& b) { \
+        packet_lanes<float> c; \
+        _mm_storeu_ps(c.v, op(_mm_loadu_ps(a.v), _mm_loadu_ps(b.v))); \
+        return c; \
+    }
+
+#define RAY_PACKET_LANES_PD(name, op) \
+    template <> \
+    inline packet_lanes<double> name(const packet_lanes<double>& a, const packet_lanes<double>& b) { \
+        packet_lanes<double> c; \
+        _mm_storeu_pd(c.v, op(_mm_loadu_pd(a.v), _mm_loadu_pd(b.v))); \
+        _mm_storeu_pd(c.v + 2, op(_mm_loadu_pd(a.v + 2), _mm_loadu_pd(b.v + 2))); \
+        return c; \
+    }
+
+RAY_PACKET_LANES_PS(lanes_add, _mm_add_ps)
+RAY_PACKET_LANES_PS(lanes_sub, _mm_sub_ps)
+RAY_PACKET_LANES_PS(lanes_mul, _mm_mul_ps)
+RAY_PACKET_LANES_PS(lanes_max, _mm_max_ps)
+RAY_PACKET_LANES_PS(lanes_min, _mm_min_ps)
+RAY_PACKET_LANES_PD(lanes_add, _mm_add_pd)
+RAY_PACKET_LANES_PD(lanes_sub, _mm_sub_pd)
+RAY_PACKET_LANES_PD(lanes_mul, _mm_mul_pd)
+RAY_PACKET_LANES_PD(lanes_max, _mm_max_pd)
+RAY_PACKET_LANES_PD(lanes_min, _mm_min_pd)
+
+#undef RAY_PACKET_LANES_PS
+#undef RAY_PACKET_LANES_PD
+
+template <>
+inline int lanes_not_less(const packet_lanes<float>& a, const packet_lanes<float>& b) {
+    return _mm_movemask_ps(_mm_cmpnlt_ps(_mm_loadu_ps(b.v), _mm_loadu_ps(a.v)));
+}
+
+template <>
+inline int lanes_not_less(const packet_lanes<double>& a, const packet_lanes<double>& b) {
+    return _mm_movemask_pd(_mm_cmpnlt_pd(_mm_loadu_pd(b.v), _mm_loadu_pd(a.v)))
+         | _mm_movemask_pd(_mm_cmpnlt_pd(_mm_loadu_pd(b.v + 2), _mm_loadu_pd(a.v + 2))) << 2;
+}
+
+#endif
+
+#endif
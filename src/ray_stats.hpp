@@ -0,0 +1,125 @@
+#ifndef RAY_STATS_H
+#define RAY_STATS_H
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+// Ray statistics, counted per thread and merged once per frame. Building with
+// -DRT_NO_STATS (make STATS=0) removes every counter from the tracing code.
+#ifdef RT_NO_STATS
+#define RT_STATS_ENABLED 0
+#define RT_STAT(statement)
+#else
+#define RT_STATS_ENABLED 1
+#define RT_STAT(statement) do { statement; } while (0)
+#endif
+
+struct ray_stats {
+    // Paths of path_length_bins - 1 segments or more share the last bin
+    static const int path_length_bins = 32;
+
+    uint64_t primary_rays;
+    uint64_t scattered_rays;    // one per bounce
+    uint64_t primitive_tests;   // ray-object intersection tests
+    uint64_t node_visits;       // bounding volume hierarchy nodes
+    uint64_t node_cache_misses; // node visits missing node_cache_model
+    uint64_t escaped;           // paths leaving the scene (sky)
+    uint64_t absorbed;          // paths stopped by a material
+    uint64_t roulette_kills;    // paths stopped by the Russian roulette
+    uint64_t path_length[path_length_bins]; // segments traced per path
+
+    void reset() { memset(this, 0, sizeof(*this)); }
+
+    void merge(const ray_stats& other) {
+        primary_rays += other.primary_rays;
+        scattered_rays += other.scattered_rays;
+        primitive_tests += other.primitive_tests;
+        node_visits += other.node_visits;
+        node_cache_misses += other.node_cache_misses;
+        escaped += other.escaped;
+        absorbed += other.absorbed;
+        roulette_kills += other.roulette_kills;
+        for (int i = 0; i < path_length_bins; i++)
+            path_length[i] += other.path_length[i];
+    }
+
+    uint64_t rays() const { return primary_rays + scattered_rays; }
+
+    void add_path(int segments) {
+        path_length[segments < path_length_bins ? segments : path_length_bins - 1]++;
+    }
+
+    double mean_path_length() const {
+        uint64_t paths = 0, segments = 0;
+        for (int i = 0; i < path_length_bins; i++) {
+            paths += path_length[i];
+            segments += path_length[i] * i;
+        }
+        return paths ? (double) segments / paths : 0.0;
+    }
+};
+
+// Counters of the calling thread, zero-initialized: no guard on access
+inline ray_stats& thread_ray_stats() {
+    static thread_local ray_stats stats;
+    return stats;
+}
+
+// Direct-mapped cache of 512 lines of 64 bytes (32 KiB, an L1 data cache)
+// holding the nodes read by the traversals of a thread, emptied at the start
+// of each frame. Its misses measure the locality of consecutive rays without
+// depending on the hardware caches, but not exactly from a run to the next:
+// they follow the tiles each thread picked and the addresses of the nodes.
+// A hierarchy that fits in the 32 KiB (the example scenes) barely misses.
+struct node_cache_model {
+    static const int lines = 512;
+    uintptr_t tags[lines];
+
+    void reset() { memset(tags, 0, sizeof(tags)); }
+
+    // True when the line of address was not cached
+    bool fetch(const void* address) {
+        uintptr_t line = reinterpret_cast<uintptr_t>(address) >> 6;
+        uintptr_t& tag = tags[line % lines];
+        if (tag == line + 1) return false;
+        tag = line + 1;
+        return true;
+    }
+};
+
+// Model of the calling thread, zero-initialized (empty)
+inline node_cache_model& thread_node_cache() {
+    static thread_local node_cache_model cache;
+    return cache;
+}
+
+// Count the visit of a node in the statistics of the calling thread
+inline void count_node_visit(const void* node) {
+    ray_stats& stats = thread_ray_stats();
+    stats.node_visits++;
+    stats.node_cache_misses += thread_node_cache().fetch(node);
+}
+
+inline std::ostream& operator<<(std::ostream &out, const ray_stats &s) {
+    out << "rays: " << s.rays() << '\n'
+        << "primary_rays: " << s.primary_rays << '\n'
+        << "scattered_rays: " << s.scattered_rays << '\n'
+        << "primitive_tests: " << s.primitive_tests << '\n'
+        << "node_visits: " << s.node_visits << '\n'
+        << "node_cache_misses: " << s.node_cache_misses << '\n'
+        << "node_visits_per_ray: " << (s.rays() ? (double) s.node_visits / s.rays() : 0.0) << '\n'
+        << "node_cache_misses_per_ray: " << (s.rays() ? (double) s.node_cache_misses / s.rays() : 0.0) << '\n'
+        << "paths_escaped: " << s.escaped << '\n'
+        << "paths_absorbed: " << s.absorbed << '\n'
+        << "paths_roulette: " << s.roulette_kills << '\n'
+        << "mean_path_length: " << s.mean_path_length() << '\n'
+        << "path_length_histogram:";
+    int last = ray_stats::path_length_bins - 1;
+    while (last > 0 && s.path_length[last] == 0) last--;
+    for (int i = 0; i <= last; i++)
+        out << ' ' << s.path_length[i];
+    return out << '\n';
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <limits>
 #include <memory>
 #include <cstdlib>
+#include <cstdint>
 #include <random>
 
 // Usings
@@ -24,9 +25,53 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// PCG32 generator (M. O'Neill, pcg-random.org): 64 bits of state, no lock,
+// one instance per thread instead of the global state behind rand().
+class pcg32 {
+    public:
+        pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+
+        void seed(uint64_t init_state, uint64_t init_seq) {
+            state = 0;
+            inc = (init_seq << 1u) | 1u;
+            next();
+            state += init_state;
+            next();
+        }
+
+        uint32_t next() {
+            uint64_t old_state = state;
+            state = old_state * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+            uint32_t rot = static_cast<uint32_t>(old_state >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+
+    private:
+        uint64_t state;
+        uint64_t inc;
+};
+
+inline pcg32& thread_rng() {
+    thread_local pcg32 rng;
+    return rng;
+}
+
+// Restart the generator of the calling thread on the sequence identified by
+// (seed, stream), e.g. stream = pixel index so that a render only depends on
+// the seed and not on which thread picked which pixel.
+inline void seed_thread_rng(uint64_t seed, uint64_t stream) {
+    // splitmix64 finalizer, decorrelates neighbouring streams
+    uint64_t z = seed + (stream + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z = z ^ (z >> 31);
+    thread_rng().seed(z, stream);
+}
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    return thread_rng().next() * (1.0 / 4294967296.0);
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,328 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rt.hpp"
+#include "hittable_list.hpp"
+#include "sphere.hpp"
+#include "moving_sphere.hpp"
+#include "material.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary scene file: a fixed header followed by two flat tables, every
+// record a plain struct in the byte order of the machine that wrote it.
+//
+//   scene_file_header
+//   scene_file_material   [n_materials]   at materials_offset
+//   scene_file_primitive  [n_primitives]  at primitives_offset
+//
+// The file is memory mapped and the tables are read in place, no text is
+// parsed. Values are kept in double so a scene renders exactly as its XML.
+
+static const char scene_file_magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+static const uint32_t scene_file_version = 2;
+
+struct scene_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+
+    // Engine
+    int32_t img_width, img_height;
+    int32_t samples_per_pixel, max_depth;
+    double aspect_ratio;
+    uint64_t seed;
+    int32_t tile_size;
+    int32_t roulette_depth;
+    double roulette_probability;
+    double roulette_threshold;
+    int32_t adaptive;
+    int32_t min_samples_per_pixel;
+    double adaptive_error;
+    int32_t progressive;
+    int32_t bvh_builder;   // 0 sah, 1 lbvh
+    int32_t precision;     // 0 double, 1 float
+    int32_t integrator;    // 0 megakernel, 1 wavefront
+    int32_t ray_sort;
+    int32_t primary_packets;
+
+    // Camera
+    double look_from[3];
+    double look_at[3];
+    double vup[3];
+    double vfov, camera_aspect_ratio, aperture, focus_dist;
+    double time0, time1;
+
+    // Tables
+    uint64_t n_materials, materials_offset;
+    uint64_t n_primitives, primitives_offset;
+};
+
+enum scene_file_material_type : uint32_t {
+    scene_file_lambertian = 0,
+    scene_file_metal = 1,
+    scene_file_dielectric = 2
+};
+
+struct scene_file_material {
+    uint32_t type;
+    uint32_t pad;
+    double albedo[3];
+    double fuzz;
+    double ir;
+};
+
+enum scene_file_primitive_type : uint32_t {
+    scene_file_sphere = 0,
+    scene_file_moving_sphere = 1
+};
+
+// A sphere only uses center0 and radius
+struct scene_file_primitive {
+    uint32_t type;
+    uint32_t material;  // index in the material table
+    double center0[3];
+    double center1[3];
+    double time0, time1;
+    double radius;
+};
+
+static_assert(sizeof(scene_file_material) == 48, "scene_file_material must be 48 bytes");
+static_assert(sizeof(scene_file_primitive) == 80, "scene_file_primitive must be 80 bytes");
+
+// Read-only memory mapping of a whole file
+class mapped_file {
+    public:
+        mapped_file(const char* filename);
+        ~mapped_file();
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        const unsigned char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        const unsigned char* bytes = nullptr;
+        size_t length = 0;
+};
+
+mapped_file::mapped_file(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) throw std::invalid_argument("Cannot open " + std::string(filename));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        throw std::invalid_argument("Cannot read " + std::string(filename));
+    }
+    length = static_cast<size_t>(st.st_size);
+
+    void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid once the descriptor is closed
+    ::close(fd);
+    if (p == MAP_FAILED) throw std::invalid_argument("Cannot map " + std::string(filename));
+
+    bytes = static_cast<const unsigned char*>(p);
+}
+
+mapped_file::~mapped_file() {
+    if (bytes != nullptr) munmap(const_cast<unsigned char*>(bytes), length);
+}
+
+// True when the file starts with the binary scene magic
+inline bool is_binary_scene_file(const char* filename) {
+    char magic[sizeof(scene_file_magic)];
+    FILE* f = fopen(filename, "rb");
+    if (f == nullptr) return false;
+    bool binary = fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+                  && memcmp(magic, scene_file_magic, sizeof(magic)) == 0;
+    fclose(f);
+    return binary;
+}
+
+// Header of a mapped scene, after checking that both tables lie in the file
+inline const scene_file_header& scene_file_checked_header(const mapped_file& file) {
+    if (file.size() < sizeof(scene_file_header))
+        throw std::invalid_argument("Binary scene file is truncated");
+
+    const scene_file_header& header = *reinterpret_cast<const scene_file_header*>(file.data());
+    if (memcmp(header.magic, scene_file_magic, sizeof(scene_file_magic)) != 0)
+        throw std::invalid_argument("File is not a binary scene");
+    if (header.version != scene_file_version || header.header_bytes != sizeof(scene_file_header))
+        throw std::invalid_argument("Unsupported binary scene version");
+
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t record) {
+        return offset % alignof(double) == 0 && offset <= file.size()
+               && count <= (file.size() - offset) / record;
+    };
+    if (!fits(header.materials_offset, header.n_materials, sizeof(scene_file_material))
+        || !fits(header.primitives_offset, header.n_primitives, sizeof(scene_file_primitive)))
+        throw std::invalid_argument("Binary scene tables do not fit in the file");
+
+    return header;
+}
+
+inline scene_file_material material_record(const material& m) {
+    scene_file_material record = {};
+    const color* albedo = nullptr;
+
+    if (auto l = dynamic_cast<const lambertian*>(&m)) {
+        record.type = scene_file_lambertian;
+        albedo = &l->albedo;
+    }
+    else if (auto mt = dynamic_cast<const metal*>(&m)) {
+        record.type = scene_file_metal;
+        albedo = &mt->albedo;
+        record.fuzz = mt->fuzz;
+    }
+    else if (auto d = dynamic_cast<const dielectric*>(&m)) {
+        record.type = scene_file_dielectric;
+        record.ir = d->ir;
+    }
+    else {
+        throw std::invalid_argument("Material cannot be saved in a binary scene");
+    }
+
+    if (albedo != nullptr)
+        for (int a = 0; a < 3; a++) record.albedo[a] = (*albedo)[a];
+    return record;
+}
+
+inline shared_ptr<material> material_from_record(const scene_file_material& record) {
+    color albedo(record.albedo[0], record.albedo[1], record.albedo[2]);
+    switch (record.type) {
+        case scene_file_lambertian:
+            return make_shared<lambertian>(albedo);
+        case scene_file_metal:
+            return make_shared<metal>(albedo, record.fuzz);
+        case scene_file_dielectric:
+            return make_shared<dielectric>(record.ir);
+        default:
+            throw std::invalid_argument("Unknown material type in binary scene");
+    }
+}
+
+// Flatten the objects of a list into the two tables, each distinct material
+// is written once however many objects use it
+inline void scene_file_tables(
+    const hittable_list& world,
+    std::vector<scene_file_material>& materials,
+    std::vector<scene_file_primitive>& primitives) {
+
+    material_table table;
+    auto index_of = [&](const shared_ptr<material>& m) {
+        if (m == nullptr) throw std::invalid_argument("Object without material in binary scene");
+        uint32_t index = static_cast<uint32_t>(table.id(m));
+        if (index == materials.size()) materials.push_back(material_record(*m));
+        return index;
+    };
+
+    primitives.reserve(world.objects.size());
+    for (auto & object : world.objects) {
+        scene_file_primitive record = {};
+        if (auto s = std::dynamic_pointer_cast<sphere>(object)) {
+            record.type = scene_file_sphere;
+            record.material = index_of(s->mat_ptr);
+            for (int a = 0; a < 3; a++) record.center0[a] = record.center1[a] = s->center[a];
+            record.radius = s->radius;
+        }
+        else if (auto ms = std::dynamic_pointer_cast<moving_sphere>(object)) {
+            record.type = scene_file_moving_sphere;
+            record.material = index_of(ms->mat_ptr);
+            for (int a = 0; a < 3; a++) {
+                record.center0[a] = ms->center0[a];
+                record.center1[a] = ms->center1[a];
+            }
+            record.time0 = ms->time0;
+            record.time1 = ms->time1;
+            record.radius = ms->radius;
+        }
+        else {
+            throw std::invalid_argument("Object cannot be saved in a binary scene");
+        }
+        primitives.push_back(record);
+    }
+}
+
+// Objects of a primitive table. The spheres live in two arrays allocated once,
+// the list holds aliasing pointers that keep those arrays alive.
+inline hittable_list scene_file_objects(
+    const scene_file_primitive* records, size_t n_records,
+    const std::vector<shared_ptr<material>>& materials) {
+
+    struct object_arrays {
+        std::vector<sphere> spheres;
+        std::vector<moving_sphere> moving_spheres;
+    };
+    auto arrays = make_shared<object_arrays>();
+
+    size_t n_spheres = 0;
+    for (size_t i = 0; i < n_records; i++) {
+        if (records[i].type == scene_file_sphere) n_spheres++;
+        else if (records[i].type != scene_file_moving_sphere)
+            throw std::invalid_argument("Unknown primitive type in binary scene");
+        if (records[i].material >= materials.size())
+            throw std::invalid_argument("Material index out of range in binary scene");
+    }
+    // Reserved up front: the arrays never move once pointers to them are taken
+    arrays->spheres.reserve(n_spheres);
+    arrays->moving_spheres.reserve(n_records - n_spheres);
+
+    hittable_list list;
+    list.objects.reserve(n_records);
+    for (size_t i = 0; i < n_records; i++) {
+        const scene_file_primitive& r = records[i];
+        point3 center0(r.center0[0], r.center0[1], r.center0[2]);
+        const shared_ptr<material>& m = materials[r.material];
+
+        if (r.type == scene_file_sphere) {
+            arrays->spheres.emplace_back(center0, r.radius, m);
+            list.objects.push_back(shared_ptr<hittable>(arrays, &arrays->spheres.back()));
+        }
+        else {
+            point3 center1(r.center1[0], r.center1[1], r.center1[2]);
+            arrays->moving_spheres.emplace_back(center0, center1, r.time0, r.time1, r.radius, m);
+            list.objects.push_back(shared_ptr<hittable>(arrays, &arrays->moving_spheres.back()));
+        }
+    }
+    return list;
+}
+
+// Write the header and both tables, the offsets of the header are filled in
+inline void write_scene_file(
+    const char* filename, scene_file_header header,
+    const std::vector<scene_file_material>& materials,
+    const std::vector<scene_file_primitive>& primitives) {
+
+    memcpy(header.magic, scene_file_magic, sizeof(scene_file_magic));
+    header.version = scene_file_version;
+    header.header_bytes = sizeof(scene_file_header);
+    header.n_materials = materials.size();
+    header.materials_offset = sizeof(scene_file_header);
+    header.n_primitives = primitives.size();
+    header.primitives_offset = header.materials_offset + materials.size() * sizeof(scene_file_material);
+
+    FILE* f = fopen(filename, "wb");
+    if (f == nullptr) throw std::invalid_argument("Cannot write " + std::string(filename));
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if (ok && !materials.empty())
+        ok = fwrite(materials.data(), sizeof(scene_file_material), materials.size(), f) == materials.size();
+    if (ok && !primitives.empty())
+        ok = fwrite(primitives.data(), sizeof(scene_file_primitive), primitives.size(), f) == primitives.size();
+
+    if (fclose(f) != 0 || !ok) throw std::invalid_argument("Cannot write " + std::string(filename));
+}
+
+#endif
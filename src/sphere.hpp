@@ -8,59 +8,123 @@
 
 #include "material.hpp"
 
+// Nearest t in [t_min, t_max] where r meets the sphere, false if none
+template <typename T>
+inline bool sphere_root(const ray_t<T>& r, const vec3_t<T>& center, T radius, T t_min, T t_max, T& root) {
+    vec3_t<T> oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant < 0) return false;
+    auto sqrtd = sqrt(discriminant);
+
+    // Find the nearest root that lies in the acceptable range.
+    root = (-half_b - sqrtd) / a;
+    if (root < t_min || t_max < root) {
+        root = (-half_b + sqrtd) / a;
+        if (root < t_min || t_max < root)
+            return false;
+    }
+    return true;
+}
+
+// In float, |oc|^2 - radius^2 and -half_b - sqrtd cancel out for a large
+// sphere seen from close by, like the ground of the example scenes, and the
+// rays bouncing off it hit it again. The discriminant is taken from the
+// distance between the center and the ray line instead, and the near root
+// as c/q (Haines et al., Precision Improvements for Ray/Sphere Intersection).
+// An origin closer to the surface than the rounding of c is on it: the root
+// at t = 0 is then exactly 0 and falls under t_min.
+inline bool sphere_root(const rayf& r, const vec3f& center, float radius, float t_min, float t_max, float& root) {
+    vec3f oc = r.origin() - center;
+    vec3f d = r.direction();
+    float a = d.length_squared();
+    float half_b = dot(oc, d);
+    float c = oc.length_squared() - radius*radius;
+    if (std::abs(c) < 4 * std::numeric_limits<float>::epsilon() * radius*radius) c = 0;
+
+    vec3f l = oc - (half_b / a) * d;
+    float discriminant = a * (radius*radius - l.length_squared());
+    if (discriminant < 0) return false;
+    float q = -(half_b + std::copysign(std::sqrt(discriminant), half_b));
+    if (q == 0) return false;
+
+    float t0 = c / q, t1 = q / a;
+    if (t1 < t0) std::swap(t0, t1);
+    root = t0;
+    if (root < t_min || t_max < root) {
+        root = t1;
+        if (root < t_min || t_max < root)
+            return false;
+    }
+    return true;
+}
+
 class sphere : public hittable {
     public:
         sphere() {}
         sphere(point3 cen, double r) : center(cen), radius(r) {};
         sphere(point3 cen, double r, shared_ptr<material> m)
             : center(cen), radius(r), mat_ptr(m) {};
-        sphere(tinyxml2::XMLElement* pElement);
+        sphere(tinyxml2::XMLElement* pElement, material_table& materials);
 
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit(
+            const rayf& r, float t_min, float t_max, hit_recordf& rec) const override;
+
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
         virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const override;
+
+        virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc, material_table& materials) const override;
 		
     public:
         point3 center;
         double radius;
         shared_ptr<material> mat_ptr;
+
+    private:
+        template <typename T>
+        bool hit_kernel(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) const;
+
+        // Element without its material
+        tinyxml2::XMLElement* geometry_xml(tinyxml2::XMLDocument& xmlDoc) const;
 };
 
-sphere::sphere(tinyxml2::XMLElement* pElement) {
+sphere::sphere(tinyxml2::XMLElement* pElement, material_table& materials) {
     radius = pElement->DoubleAttribute("Radius");
 
     tinyxml2::XMLElement* center_xml = pElement->FirstChildElement("Center");
     center = point3(center_xml->DoubleAttribute("x"), center_xml->DoubleAttribute("y"), center_xml->DoubleAttribute("z"));
 
-    mat_ptr = material::material_from_xml(pElement->FirstChildElement("Material"));
+    mat_ptr = materials.material_from_xml(pElement->FirstChildElement("Material"));
 }
 
 bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius*radius;
+    return hit_kernel(r, t_min, t_max, rec);
+}
 
-    auto discriminant = half_b*half_b - a*c;
-    if (discriminant < 0) return false;
-    auto sqrtd = sqrt(discriminant);
+bool sphere::hit(const rayf& r, float t_min, float t_max, hit_recordf& rec) const {
+    return hit_kernel(r, t_min, t_max, rec);
+}
 
-    // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
-    if (root < t_min || t_max < root) {
-        root = (-half_b + sqrtd) / a;
-        if (root < t_min || t_max < root)
-            return false;
-    }
+template <typename T>
+bool sphere::hit_kernel(const ray_t<T>& r, T t_min, T t_max, hit_record_t<T>& rec) const {
+    const vec3_t<T> cen(center);
+    const T rad = static_cast<T>(radius);
+
+    T root;
+    if (!sphere_root(r, cen, rad, t_min, t_max, root)) return false;
 
     rec.t = root;
     rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - center) / radius;
+    vec3_t<T> outward_normal = (rec.p - cen) / rad;
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
 
     return true;
 }
@@ -72,7 +136,7 @@ bool sphere::bounding_box(double time0, double time1, aabb& output_box) const {
     return true;
 }
 
-tinyxml2::XMLElement* sphere::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+tinyxml2::XMLElement* sphere::geometry_xml(tinyxml2::XMLDocument& xmlDoc) const {
     tinyxml2::XMLElement * pElement = xmlDoc.NewElement("Sphere");
     
     pElement->SetAttribute("Radius", radius);
@@ -85,6 +149,18 @@ tinyxml2::XMLElement* sphere::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
 
     pElement->InsertEndChild(center_xml);
 
+    return pElement;
+}
+
+tinyxml2::XMLElement* sphere::to_xml(tinyxml2::XMLDocument& xmlDoc, material_table& materials) const {
+    tinyxml2::XMLElement * pElement = geometry_xml(xmlDoc);
+    pElement->InsertEndChild(materials.reference_xml(xmlDoc, mat_ptr));
+    return pElement;
+}
+
+tinyxml2::XMLElement* sphere::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+    tinyxml2::XMLElement * pElement = geometry_xml(xmlDoc);
+
     tinyxml2::XMLElement* material_xml = xmlDoc.NewElement("Material");
     tinyxml2::XMLElement* materialElement = mat_ptr->to_xml(xmlDoc);
     
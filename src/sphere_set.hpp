@@ -0,0 +1,406 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "rt.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "sphere.hpp"
+#include "moving_sphere.hpp"
+
+#include <vector>
+
+#include "../include/tinyxml2.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPHERE_SET_X86
+#include <immintrin.h>
+#endif
+
+// Instruction set used by sphere_set::hit_range, detected once at startup
+enum class simd_level { scalar, sse, avx2 };
+
+inline const char* simd_level_name(simd_level level) {
+    switch (level) {
+        case simd_level::avx2: return "avx2";
+        case simd_level::sse: return "sse";
+        default: return "scalar";
+    }
+}
+
+// Spheres tested at once
+inline int simd_lanes(simd_level level) {
+    switch (level) {
+        case simd_level::avx2: return 8;
+        case simd_level::sse: return 4;
+        default: return 1;
+    }
+}
+
+inline simd_level detect_simd_level() {
+#ifdef SPHERE_SET_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return simd_level::avx2;
+    return simd_level::sse;
+#else
+    return simd_level::scalar;
+#endif
+}
+
+inline simd_level& sphere_set_simd_level() {
+    static simd_level level = detect_simd_level();
+    return level;
+}
+
+// Spheres and moving spheres stored as structure of arrays. Candidate hits
+// are found by testing 4 (SSE) or 8 (AVX2) spheres at once in float, against
+// spheres slightly inflated so that rounding never misses a hit, and each
+// candidate is then intersected exactly in the precision of the ray, like
+// sphere::hit and moving_sphere::hit would.
+class sphere_set : public hittable {
+    public:
+        sphere_set() {}
+
+        // Append a sphere or a moving_sphere, false for any other object
+        bool add(const shared_ptr<hittable>& object);
+
+        size_t size() const { return exact.size(); }
+
+        // Intersect the spheres [first, first + count)
+        template <typename T>
+        bool hit_range(
+            const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const;
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_range(r, 0, size(), t_min, t_max, rec);
+        }
+
+        virtual bool hit(
+            const rayf& r, float t_min, float t_max, hit_recordf& rec) const override {
+            return hit_range(r, 0, size(), t_min, t_max, rec);
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+        virtual tinyxml2::XMLElement* to_xml(tinyxml2::XMLDocument& xmlDoc) const override;
+
+    public:
+        // Float copies for the SIMD test, padded with lanes_padding empty
+        // entries so that the last group of lanes can always be loaded.
+        // center(time) = center0 + (time - time0) * time_scale * delta
+        std::vector<float> center_x, center_y, center_z;
+        std::vector<float> delta_x, delta_y, delta_z;
+        std::vector<float> time0, time_scale;
+        std::vector<float> inflated_radius2;
+
+        // Data of the exact test, in both precisions
+        template <typename T>
+        struct exact_sphere_t {
+            vec3_t<T> center0, center1;
+            T time0, time1;
+            T radius;
+            bool moving;
+            const material* mat_ptr;
+        };
+        typedef exact_sphere_t<double> exact_sphere;
+        std::vector<exact_sphere> exact;
+        std::vector<exact_sphere_t<float>> exact_float;
+
+        template <typename T>
+        const std::vector<exact_sphere_t<T>>& exact_spheres() const;
+
+        // Owning references, the set shares the spheres of the scene
+        std::vector<shared_ptr<hittable>> sources;
+
+        static const int lanes_padding = 8;
+
+    private:
+        void push_float(const exact_sphere& s);
+
+        template <typename T>
+        bool hit_exact(const ray_t<T>& r, size_t i, T t_min, T t_max, hit_record_t<T>& rec) const;
+
+        template <typename T>
+        bool hit_scalar(const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const;
+#ifdef SPHERE_SET_X86
+        template <typename T>
+        bool hit_sse(const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const;
+        template <typename T>
+        __attribute__((target("avx2")))
+        bool hit_avx2(const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const;
+#endif
+};
+
+// Relative margins of the float test: |oc|^2 is shrunk and radius^2 grown by
+// much more than the float rounding errors, so the culled spheres really miss
+static const float sphere_set_oc_margin = 1.0f - 1e-5f;
+static const float sphere_set_radius_margin = 1.0f + 2e-3f;
+
+// Ray interval widened the same way
+inline float sphere_set_lower_bound(double t) { return static_cast<float>(t - fabs(t) * 1e-4); }
+inline float sphere_set_upper_bound(double t) { return static_cast<float>(t + fabs(t) * 1e-4); }
+
+bool sphere_set::add(const shared_ptr<hittable>& object) {
+    exact_sphere s;
+
+    if (auto sp = std::dynamic_pointer_cast<sphere>(object)) {
+        s.center0 = s.center1 = sp->center;
+        s.time0 = 0;
+        s.time1 = 1;
+        s.radius = sp->radius;
+        s.moving = false;
+        s.mat_ptr = sp->mat_ptr.get();
+    }
+    else if (auto ms = std::dynamic_pointer_cast<moving_sphere>(object)) {
+        s.center0 = ms->center0;
+        s.center1 = ms->center1;
+        s.time0 = ms->time0;
+        s.time1 = ms->time1;
+        s.radius = ms->radius;
+        s.moving = true;
+        s.mat_ptr = ms->mat_ptr.get();
+    }
+    else {
+        return false;
+    }
+
+    // Drop the padding, push the sphere and pad again
+    if (!center_x.empty()) {
+        for (auto v : {&center_x, &center_y, &center_z, &delta_x, &delta_y, &delta_z,
+                       &time0, &time_scale, &inflated_radius2})
+            v->resize(exact.size());
+    }
+
+    exact.push_back(s);
+    exact_float.push_back({ point3f(s.center0), point3f(s.center1), static_cast<float>(s.time0),
+                            static_cast<float>(s.time1), static_cast<float>(s.radius), s.moving, s.mat_ptr });
+    sources.push_back(object);
+    push_float(s);
+
+    exact_sphere empty = { point3(), point3(), 0, 1, 0, false, nullptr };
+    for (int i = 0; i < lanes_padding; i++)
+        push_float(empty);
+
+    return true;
+}
+
+void sphere_set::push_float(const exact_sphere& s) {
+    center_x.push_back(static_cast<float>(s.center0.x()));
+    center_y.push_back(static_cast<float>(s.center0.y()));
+    center_z.push_back(static_cast<float>(s.center0.z()));
+
+    auto delta = s.center1 - s.center0;
+    delta_x.push_back(static_cast<float>(delta.x()));
+    delta_y.push_back(static_cast<float>(delta.y()));
+    delta_z.push_back(static_cast<float>(delta.z()));
+
+    time0.push_back(static_cast<float>(s.time0));
+    time_scale.push_back((s.moving && s.time1 != s.time0) ? static_cast<float>(1.0 / (s.time1 - s.time0)) : 0.0f);
+
+    // Empty padding lanes get a negative squared radius, they never hit
+    float radius2 = static_cast<float>(s.radius * s.radius) * sphere_set_radius_margin;
+    inflated_radius2.push_back(s.mat_ptr == nullptr ? -1.0f : radius2 + 1e-6f);
+}
+
+template <>
+inline const std::vector<sphere_set::exact_sphere_t<double>>& sphere_set::exact_spheres<double>() const {
+    return exact;
+}
+
+template <>
+inline const std::vector<sphere_set::exact_sphere_t<float>>& sphere_set::exact_spheres<float>() const {
+    return exact_float;
+}
+
+template <typename T>
+inline bool sphere_set::hit_exact(const ray_t<T>& r, size_t i, T t_min, T t_max, hit_record_t<T>& rec) const {
+    const exact_sphere_t<T>& s = exact_spheres<T>()[i];
+    vec3_t<T> center = s.moving
+        ? s.center0 + ((r.time() - s.time0) / (s.time1 - s.time0))*(s.center1 - s.center0)
+        : s.center0;
+
+    T root;
+    if (!sphere_root(r, center, s.radius, t_min, t_max, root)) return false;
+
+    rec.t = root;
+    rec.p = r.at(rec.t);
+    vec3_t<T> outward_normal = (rec.p - center) / s.radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = s.mat_ptr;
+
+    return true;
+}
+
+template <typename T>
+bool sphere_set::hit_range(
+    const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const {
+#ifdef SPHERE_SET_X86
+    switch (sphere_set_simd_level()) {
+        case simd_level::avx2: return hit_avx2(r, first, count, t_min, t_max, rec);
+        case simd_level::sse: return hit_sse(r, first, count, t_min, t_max, rec);
+        default: break;
+    }
+#endif
+    return hit_scalar(r, first, count, t_min, t_max, rec);
+}
+
+template <typename T>
+bool sphere_set::hit_scalar(
+    const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const {
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    for (size_t i = first; i < first + count; i++) {
+        if (hit_exact(r, i, t_min, closest_so_far, rec)) {
+            hit_anything = true;
+            closest_so_far = rec.t;
+        }
+    }
+
+    return hit_anything;
+}
+
+#ifdef SPHERE_SET_X86
+
+template <typename T>
+bool sphere_set::hit_sse(
+    const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const {
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    const vec3_t<T> orig = r.origin();
+    const vec3_t<T> dir = r.direction();
+    const float a = static_cast<float>(dir.length_squared());
+
+    const __m128 ox = _mm_set1_ps(static_cast<float>(orig.x()));
+    const __m128 oy = _mm_set1_ps(static_cast<float>(orig.y()));
+    const __m128 oz = _mm_set1_ps(static_cast<float>(orig.z()));
+    const __m128 dx = _mm_set1_ps(static_cast<float>(dir.x()));
+    const __m128 dy = _mm_set1_ps(static_cast<float>(dir.y()));
+    const __m128 dz = _mm_set1_ps(static_cast<float>(dir.z()));
+    const __m128 time = _mm_set1_ps(static_cast<float>(r.time()));
+    const __m128 va = _mm_set1_ps(a);
+    const __m128 inv_a = _mm_set1_ps(1.0f / a);
+    const __m128 margin = _mm_set1_ps(sphere_set_oc_margin);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 tmin = _mm_set1_ps(sphere_set_lower_bound(t_min));
+
+    for (size_t i = first; i < first + count; i += 4) {
+        __m128 s = _mm_mul_ps(_mm_sub_ps(time, _mm_loadu_ps(&time0[i])), _mm_loadu_ps(&time_scale[i]));
+        __m128 ocx = _mm_sub_ps(ox, _mm_add_ps(_mm_loadu_ps(&center_x[i]), _mm_mul_ps(s, _mm_loadu_ps(&delta_x[i]))));
+        __m128 ocy = _mm_sub_ps(oy, _mm_add_ps(_mm_loadu_ps(&center_y[i]), _mm_mul_ps(s, _mm_loadu_ps(&delta_y[i]))));
+        __m128 ocz = _mm_sub_ps(oz, _mm_add_ps(_mm_loadu_ps(&center_z[i]), _mm_mul_ps(s, _mm_loadu_ps(&delta_z[i]))));
+
+        __m128 half_b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+        __m128 oc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(oc2, margin), _mm_loadu_ps(&inflated_radius2[i]));
+        __m128 disc = _mm_sub_ps(_mm_mul_ps(half_b, half_b), _mm_mul_ps(va, c));
+
+        __m128 sqrtd = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+        __m128 t_near = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, half_b), sqrtd), inv_a);
+        __m128 t_far = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(zero, half_b), sqrtd), inv_a);
+        __m128 tmax = _mm_set1_ps(sphere_set_upper_bound(closest_so_far));
+
+        __m128 candidate = _mm_and_ps(_mm_cmpge_ps(disc, zero),
+                           _mm_and_ps(_mm_cmpge_ps(t_far, tmin), _mm_cmple_ps(t_near, tmax)));
+        int mask = _mm_movemask_ps(candidate);
+
+        size_t lanes = first + count - i;
+        if (lanes < 4) mask &= (1 << lanes) - 1;
+
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (hit_exact(r, i + lane, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+                closest_so_far = rec.t;
+            }
+        }
+    }
+
+    return hit_anything;
+}
+
+template <typename T>
+__attribute__((target("avx2")))
+bool sphere_set::hit_avx2(
+    const ray_t<T>& r, size_t first, size_t count, T t_min, T t_max, hit_record_t<T>& rec) const {
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    const vec3_t<T> orig = r.origin();
+    const vec3_t<T> dir = r.direction();
+    const float a = static_cast<float>(dir.length_squared());
+
+    const __m256 ox = _mm256_set1_ps(static_cast<float>(orig.x()));
+    const __m256 oy = _mm256_set1_ps(static_cast<float>(orig.y()));
+    const __m256 oz = _mm256_set1_ps(static_cast<float>(orig.z()));
+    const __m256 dx = _mm256_set1_ps(static_cast<float>(dir.x()));
+    const __m256 dy = _mm256_set1_ps(static_cast<float>(dir.y()));
+    const __m256 dz = _mm256_set1_ps(static_cast<float>(dir.z()));
+    const __m256 time = _mm256_set1_ps(static_cast<float>(r.time()));
+    const __m256 va = _mm256_set1_ps(a);
+    const __m256 inv_a = _mm256_set1_ps(1.0f / a);
+    const __m256 margin = _mm256_set1_ps(sphere_set_oc_margin);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 tmin = _mm256_set1_ps(sphere_set_lower_bound(t_min));
+
+    for (size_t i = first; i < first + count; i += 8) {
+        __m256 s = _mm256_mul_ps(_mm256_sub_ps(time, _mm256_loadu_ps(&time0[i])), _mm256_loadu_ps(&time_scale[i]));
+        __m256 ocx = _mm256_sub_ps(ox, _mm256_add_ps(_mm256_loadu_ps(&center_x[i]), _mm256_mul_ps(s, _mm256_loadu_ps(&delta_x[i]))));
+        __m256 ocy = _mm256_sub_ps(oy, _mm256_add_ps(_mm256_loadu_ps(&center_y[i]), _mm256_mul_ps(s, _mm256_loadu_ps(&delta_y[i]))));
+        __m256 ocz = _mm256_sub_ps(oz, _mm256_add_ps(_mm256_loadu_ps(&center_z[i]), _mm256_mul_ps(s, _mm256_loadu_ps(&delta_z[i]))));
+
+        __m256 half_b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+        __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+        __m256 c = _mm256_sub_ps(_mm256_mul_ps(oc2, margin), _mm256_loadu_ps(&inflated_radius2[i]));
+        __m256 disc = _mm256_sub_ps(_mm256_mul_ps(half_b, half_b), _mm256_mul_ps(va, c));
+
+        __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+        __m256 t_near = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, half_b), sqrtd), inv_a);
+        __m256 t_far = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, half_b), sqrtd), inv_a);
+        __m256 tmax = _mm256_set1_ps(sphere_set_upper_bound(closest_so_far));
+
+        __m256 candidate = _mm256_and_ps(_mm256_cmp_ps(disc, zero, _CMP_GE_OQ),
+                           _mm256_and_ps(_mm256_cmp_ps(t_far, tmin, _CMP_GE_OQ), _mm256_cmp_ps(t_near, tmax, _CMP_LE_OQ)));
+        int mask = _mm256_movemask_ps(candidate);
+
+        size_t lanes = first + count - i;
+        if (lanes < 8) mask &= (1 << lanes) - 1;
+
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (hit_exact(r, i + lane, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+                closest_so_far = rec.t;
+            }
+        }
+    }
+
+    return hit_anything;
+}
+
+#endif
+
+bool sphere_set::bounding_box(double _time0, double _time1, aabb& output_box) const {
+    if (sources.empty()) return false;
+
+    aabb temp_box;
+    for (size_t i = 0; i < sources.size(); i++) {
+        sources[i]->bounding_box(_time0, _time1, temp_box);
+        output_box = i == 0 ? temp_box : surrounding_box(output_box, temp_box);
+    }
+    return true;
+}
+
+tinyxml2::XMLElement* sphere_set::to_xml(tinyxml2::XMLDocument& xmlDoc) const {
+    tinyxml2::XMLElement * pElement = xmlDoc.NewElement("List");
+
+    for (auto & item : sources)
+        pElement->InsertEndChild(item->to_xml(xmlDoc));
+
+    return pElement;
+}
+
+#endif
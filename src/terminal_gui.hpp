@@ -43,6 +43,9 @@ namespace termGui {
             /* Update progress bar if the engine is working */
             void updateProgressBar();
 
+            /* Print the ray statistics of the last frame under the progress bar */
+            void printRayStats();
+
             /* Create header*/
             void initHeaderWindow();
             
@@ -129,12 +132,12 @@ namespace termGui {
         starty = 10;
         optWin = newwin(height, width, starty, startx);
 
-        /* Construct progress bar window */
-        height = 2;
+        /* Construct progress bar window, ray statistics on its last two lines */
+        height = 4;
         width = 61;
         // startx = (COLS - width) / 2;
         startx = 0;
-        starty = (LINES - 2);
+        starty = (LINES - 4);
         progressBarWindow = newwin(height, width, starty, startx);
 
         sf::Sprite sprite(rtEngine.getTexture());
@@ -146,6 +149,7 @@ namespace termGui {
             }
             else {
                 wclear(progressBarWindow);
+                if (rtEngine.hasImageReady()) printRayStats();
                 wrefresh(progressBarWindow);
 
                 initOptWin();
@@ -155,22 +159,42 @@ namespace termGui {
     }   
 
     void term::updateProgressBar() {
-        double progress = (double) (rtEngine.getImgHeight() - rtEngine.getRemainingLines()) / rtEngine.getImgHeight() * 100.0;
+        int total = rtEngine.getTotalTiles() > 0 ? rtEngine.getTotalTiles() : 1;
+        int done = total - rtEngine.getRemainingTiles();
+        double progress = (double) done / total * 100.0;
         auto end_time = std::chrono::steady_clock::now();
         std::chrono::duration<double> diff = end_time - rtEngine.workStartTime();
 
-        double time_to_finish = (diff.count() / (rtEngine.getImgHeight() - rtEngine.getRemainingLines())) * 
-                                    rtEngine.getRemainingLines();
+        double time_to_finish = done > 0 ? (diff.count() / done) * rtEngine.getRemainingTiles() : 0.0;
 
         werase(progressBarWindow);
         wmove(progressBarWindow, 0, 0);
-        wprintw(progressBarWindow, "[Elapsed time %7.1lf s]  [Remaining time %7.1lf s]\n", diff, time_to_finish);
+        wprintw(progressBarWindow, "[Elapsed time %7.1lf s]  [Remaining time %7.1lf s]\n", diff.count(), time_to_finish);
         wprintw(progressBarWindow, "[");
         for (auto i = 2; i <= progress; i += 2){
             wprintw(progressBarWindow, "#");
         }
         mvwprintw(progressBarWindow, 1, 51, "] %5.1lf %%", progress);
+        printRayStats();
         wrefresh(progressBarWindow);
+
+        if (rtEngine.isProgressive()) {
+            // The preview is refined pass after pass, 'x' keeps the current one
+            nodelay(inputWin, true);
+            if (wgetch(inputWin) == 'x') rtEngine.stopWork();
+            nodelay(inputWin, false);
+        }
+    }
+
+    void term::printRayStats() {
+        if (!RT_STATS_ENABLED) return;
+
+        const ray_stats& stats = rtEngine.getRayStats();
+        double rays = stats.rays() > 0 ? (double) stats.rays() : 1.0;
+        mvwprintw(progressBarWindow, 2, 0, "[Rays %12llu]  [%8.3lf Mrays/s]  [Path %5.2lf]",
+                  (unsigned long long) stats.rays(), rtEngine.getRaysPerSecond() / 1e6, stats.mean_path_length());
+        mvwprintw(progressBarWindow, 3, 0, "[Tests/ray %7.2lf]  [Nodes/ray %7.2lf]  [Primary %5.1lf %%]",
+                  stats.primitive_tests / rays, stats.node_visits / rays, 100.0 * stats.primary_rays / rays);
     }
 
     void term::initHeaderWindow() {
@@ -196,6 +220,7 @@ namespace termGui {
         wprintw(optWin, "p - Load example scene\n");
         wprintw(optWin, "s - Save scene in XML format\n");
         wprintw(optWin, "i - Save scene in image format\n");
+        wprintw(optWin, "g - Progressive rendering (%s)\n", rtEngine.isProgressive() ? "on" : "off");
         wprintw(optWin, "q - quit\n");
         wrefresh(optWin);
 
@@ -205,9 +230,15 @@ namespace termGui {
         switch(c) {
             case '\n':
                 rtEngine.setToWork();
-                mvwprintw(optWin, 10, 0, "Working.... wait render to finish before pressing any key");
+                if (rtEngine.isProgressive())
+                    mvwprintw(optWin, 10, 0, "Working.... press x to stop after the current pass");
+                else
+                    mvwprintw(optWin, 10, 0, "Working.... wait render to finish before pressing any key");
                 wrefresh(optWin);
                 break;
+            case 'g':
+                rtEngine.setProgressive(!rtEngine.isProgressive());
+                break;
             case 'c':
                 newScene();
                 wrefresh(optWin);
@@ -412,7 +443,7 @@ namespace termGui {
 
     void term::saveImage() {
         auto filename = getFilename();
-        rtEngine.getTexture().copyToImage().saveToFile(filename);
+        rtEngine.saveImage(filename.c_str());
         mvwprintw(optWin, 10, 0, "Saved! Press enter to return");
         wrefresh(optWin);
         auto c = wgetch(inputWin);
@@ -441,6 +472,8 @@ namespace termGui {
         max_depth = getIntParameter(line++);
 
         rtEngine = Engine(imgWidth, imgHeight, samples_per_pixel, max_depth);
+        // Every item added rebuilds the accelerator: favour build speed
+        rtEngine.setBvhBuilder(bvh_builder::lbvh);
 
         line = 0;
         werase(optWin);
@@ -0,0 +1,123 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Rectangle of pixels [x0, x1) x [y0, y1), rows counted from the top of the image
+struct tile {
+    int x0, y0, x1, y1;
+};
+
+// Time spent by a worker on a tile during the last frame
+struct tile_timing {
+    int x, y, width, height;
+    int worker;
+    double seconds;
+};
+
+// Interleave the bits of x and y (Z-order curve)
+inline uint32_t morton_2d(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// Splits an image in square tiles sorted along a Morton curve and hands them
+// out to a fixed set of workers. Each worker starts with a contiguous run of
+// the curve (neighbouring tiles, warm caches) and, once its own queue is
+// empty, steals tiles from the back of the other queues.
+class tile_scheduler {
+    public:
+        tile_scheduler(int img_width, int img_height, int tile_size, int n_workers);
+
+        // Index of the next tile for this worker, false once every tile is taken
+        bool next(int worker, int& tile_index);
+
+        const std::vector<tile>& tiles() const { return tile_list; }
+
+    private:
+        struct worker_queue {
+            std::mutex lock;
+            std::deque<int> tiles;
+        };
+
+        std::vector<tile> tile_list;
+        std::vector<std::unique_ptr<worker_queue>> queues;
+};
+
+tile_scheduler::tile_scheduler(int img_width, int img_height, int tile_size, int n_workers) {
+    if (tile_size < 1) tile_size = 1;
+    if (n_workers < 1) n_workers = 1;
+
+    int n_x = (img_width + tile_size - 1) / tile_size;
+    int n_y = (img_height + tile_size - 1) / tile_size;
+
+    std::vector<std::pair<uint32_t, tile>> ordered;
+    ordered.reserve(n_x * n_y);
+    for (int ty = 0; ty < n_y; ty++) {
+        for (int tx = 0; tx < n_x; tx++) {
+            tile t;
+            t.x0 = tx * tile_size;
+            t.y0 = ty * tile_size;
+            t.x1 = std::min(t.x0 + tile_size, img_width);
+            t.y1 = std::min(t.y0 + tile_size, img_height);
+            ordered.push_back(std::make_pair(morton_2d(tx, ty), t));
+        }
+    }
+    std::sort(ordered.begin(), ordered.end(),
+        [](const std::pair<uint32_t, tile>& a, const std::pair<uint32_t, tile>& b) {
+            return a.first < b.first;
+        });
+
+    tile_list.reserve(ordered.size());
+    for (auto & entry : ordered)
+        tile_list.push_back(entry.second);
+
+    int n_tiles = static_cast<int>(tile_list.size());
+    for (int w = 0; w < n_workers; w++) {
+        queues.push_back(std::unique_ptr<worker_queue>(new worker_queue()));
+        for (int t = n_tiles * w / n_workers; t < n_tiles * (w + 1) / n_workers; t++)
+            queues[w]->tiles.push_back(t);
+    }
+}
+
+bool tile_scheduler::next(int worker, int& tile_index) {
+    int n_workers = static_cast<int>(queues.size());
+    worker %= n_workers;
+
+    {
+        std::lock_guard<std::mutex> guard(queues[worker]->lock);
+        auto& own = queues[worker]->tiles;
+        if (!own.empty()) {
+            tile_index = own.front();
+            own.pop_front();
+            return true;
+        }
+    }
+
+    // Own queue empty: steal from the end of the other workers queues
+    for (int i = 1; i < n_workers; i++) {
+        auto& victim = *queues[(worker + i) % n_workers];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tiles.empty()) {
+            tile_index = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif
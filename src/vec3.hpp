@@ -3,6 +3,7 @@
 
 #include <cmath>
 #include <iostream>
+#include <algorithm>
 #include <random>
 #include "../include/tinyxml2.h"
 
@@ -10,65 +11,77 @@
 
 using std::sqrt;
 
-class vec3 
+// Vector over the scalar type T: double for the reference renders, float
+// for the single precision mode of the engine (see render_precision)
+template <typename T>
+class vec3_t
 {
 	public:
-		vec3() : e{0,0,0} {}
+		typedef T scalar;
+
+		vec3_t() : e{0,0,0} {}
 		
-		vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+		vec3_t(T e0, T e1, T e2) : e{e0, e1, e2} {}
+
+		// Conversion between precisions, explicit so that no kernel silently
+		// mixes float and double
+		template <typename U>
+		explicit vec3_t(const vec3_t<U>& v)
+			: e{static_cast<T>(v.e[0]), static_cast<T>(v.e[1]), static_cast<T>(v.e[2])} {}
 
-		vec3(tinyxml2::XMLElement* pElement) {
-			e[0] = pElement->DoubleAttribute("x");
-			e[1] = pElement->DoubleAttribute("y");
-			e[2] = pElement->DoubleAttribute("z");
+		vec3_t(tinyxml2::XMLElement* pElement) {
+			e[0] = static_cast<T>(pElement->DoubleAttribute("x"));
+			e[1] = static_cast<T>(pElement->DoubleAttribute("y"));
+			e[2] = static_cast<T>(pElement->DoubleAttribute("z"));
 		}
 		
-		double x() const { return e[0]; }
+		T x() const { return e[0]; }
 		
-		double y() const { return e[1]; }
+		T y() const { return e[1]; }
 		
-		double z() const { return e[2]; }
+		T z() const { return e[2]; }
 		
-		vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+		vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
 		
-		double operator[](int i) const { return e[i]; }
+		T operator[](int i) const { return e[i]; }
 		
-		double& operator[](int i) { return e[i]; }
+		T& operator[](int i) { return e[i]; }
 		
-		vec3& operator+=(const vec3 &v) {
+		vec3_t& operator+=(const vec3_t &v) {
 			e[0] += v.e[0];
 			e[1] += v.e[1];
 			e[2] += v.e[2];
 			return *this;
 		}
 		
-		vec3& operator*=(const double t) {
+		vec3_t& operator*=(const T t) {
 			e[0] *= t;
 			e[1] *= t;
 			e[2] *= t;
 			return *this;
 		}
 		
-		vec3& operator/=(const double t) {
+		vec3_t& operator/=(const T t) {
 			return *this *= 1/t;
 		}
 		
-		double length() const {
+		T length() const {
 			return sqrt(length_squared());
 		}
 		
-		double length_squared() const {
+		T length_squared() const {
 			return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
 		}
 		
 		
 		
-		inline static vec3 random() {
-			return vec3(random_double(), random_double(), random_double());
+		inline static vec3_t random() {
+			return vec3_t(static_cast<T>(random_double()), static_cast<T>(random_double()), static_cast<T>(random_double()));
 		}
 
-		inline static vec3 random(double min, double max) {
-			return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
+		inline static vec3_t random(double min, double max) {
+			return vec3_t(static_cast<T>(random_double(min,max)), static_cast<T>(random_double(min,max)),
+			              static_cast<T>(random_double(min,max)));
 		}
 		
 		bool near_zero() const {
@@ -78,89 +91,111 @@ class vec3
 		}
 
 		void to_xml(tinyxml2::XMLElement * pElement) const {
-			pElement->SetAttribute("x", x());
-			pElement->SetAttribute("y", y());
-			pElement->SetAttribute("z", z());
+			pElement->SetAttribute("x", static_cast<double>(x()));
+			pElement->SetAttribute("y", static_cast<double>(y()));
+			pElement->SetAttribute("z", static_cast<double>(z()));
 		}
 		
 	public: // il y avait a priori une faute dans le pdf donc j'ai modifié le "public" en "private" -> en fait non
-		double e[3];
+		T e[3];
 };
 // Type aliases for vec3
+using vec3 = vec3_t<double>;
 using point3 = vec3; // 3D point
 using color = vec3; // RGB color
 
-// vec3 Utility Functions
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
+// Single precision counterparts
+using vec3f = vec3_t<float>;
+using point3f = vec3f;
+using colorf = vec3f;
+
+// vec3 Utility Functions, the scalar arguments take the type of the vector
+template <typename T>
+inline std::ostream& operator<<(std::ostream &out, const vec3_t<T> &v) {
 return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T> &u, const vec3_t<T> &v) {
+return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T> &u, const vec3_t<T> &v) {
+return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &u, const vec3_t<T> &v) {
+return vec3_t<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
-inline vec3 operator*(double t, const vec3 &v) {
-return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T> &v) {
+return vec3_t<T>(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
-inline vec3 operator*(const vec3 &v, double t) {
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &v, typename vec3_t<T>::scalar t) {
 return t * v;
 }
-inline vec3 operator/(vec3 v, double t) {
+template <typename T>
+inline vec3_t<T> operator/(vec3_t<T> v, typename vec3_t<T>::scalar t) {
 return (1/t) * v;
 }
-inline double dot(const vec3 &u, const vec3 &v) {
+template <typename T>
+inline T dot(const vec3_t<T> &u, const vec3_t<T> &v) {
 return u.e[0] * v.e[0]
 + u.e[1] * v.e[1]
 + u.e[2] * v.e[2];
 }
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T> &u, const vec3_t<T> &v) {
+return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
 u.e[2] * v.e[0] - u.e[0] * v.e[2],
 u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
-inline vec3 unit_vector(vec3 v) {
+template <typename T>
+inline vec3_t<T> unit_vector(vec3_t<T> v) {
 return v / v.length();
 }
 
-inline vec3 random_in_unit_sphere() {
+template <typename T = double>
+inline vec3_t<T> random_in_unit_sphere() {
 	while (true) {
-		auto p = vec3::random(-1,1);
+		auto p = vec3_t<T>::random(-1,1);
 		if (p.length_squared() >= 1) continue;
 		return p;
 	}
 }
 
-inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+template <typename T = double>
+inline vec3_t<T> random_unit_vector() {
+    return unit_vector(random_in_unit_sphere<T>());
 }
 
 // encore un autre moteur de rendu diffu
-inline vec3 random_in_hemisphere(const vec3& normal) {
-    vec3 in_unit_sphere = random_in_unit_sphere();
+template <typename T>
+inline vec3_t<T> random_in_hemisphere(const vec3_t<T>& normal) {
+    vec3_t<T> in_unit_sphere = random_in_unit_sphere<T>();
     if (dot(in_unit_sphere, normal) > 0.0) // In the same hemisphere as the normal
         return in_unit_sphere;
     else
         return -in_unit_sphere;
 }
 
-inline vec3 reflect(const vec3& v, const vec3& n) {
+template <typename T>
+inline vec3_t<T> reflect(const vec3_t<T>& v, const vec3_t<T>& n) {
     return v - 2*dot(v,n)*n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    auto cos_theta = fmin(dot(-uv, n), 1.0);
-    vec3 r_out_perp =  etai_over_etat * (uv + cos_theta*n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+template <typename T>
+inline vec3_t<T> refract(const vec3_t<T>& uv, const vec3_t<T>& n, typename vec3_t<T>::scalar etai_over_etat) {
+    auto cos_theta = std::min(dot(-uv, n), T(1));
+    vec3_t<T> r_out_perp =  etai_over_etat * (uv + cos_theta*n);
+    vec3_t<T> r_out_parallel = -sqrt(std::abs(T(1) - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 
-inline vec3 random_in_unit_disk() {
+template <typename T = double>
+inline vec3_t<T> random_in_unit_disk() {
     while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
+        auto p = vec3_t<T>(static_cast<T>(random_double(-1,1)), static_cast<T>(random_double(-1,1)), 0);
         if (p.length_squared() >= 1) continue;
         return p;
     }
@@ -0,0 +1,139 @@
+// Checks of the scene files: loading, materials, binary conversion. Each
+// check prints a line, the program exits with 1 when one of them fails.
+//
+//   scene_test [--dir=directory for the temporary files]
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "engine.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) failures++;
+}
+
+static void write_file(const std::string& path, const char* text) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == nullptr) throw std::invalid_argument("Cannot write " + path);
+    fputs(text, f);
+    fclose(f);
+}
+
+// Albedo of the Lambertian of the i-th sphere of the world
+static color sphere_albedo(Engine& engine, size_t i) {
+    auto s = std::dynamic_pointer_cast<sphere>(engine.getWorld().objects[i]);
+    if (s == nullptr) return color(-1, -1, -1);
+    auto l = std::dynamic_pointer_cast<lambertian>(s->mat_ptr);
+    return l != nullptr ? l->albedo : color(-1, -1, -1);
+}
+
+static bool same_color(const color& a, const color& b) {
+    return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+}
+
+// Two equal inline materials then a different one: the second is interned into
+// the first and freed, the third must not be taken for it
+static const char* repeated_materials_scene = R"(<Root>
+    <Engine ImgWidth="48" ImgHeight="32" SamplesPerPixel="1" AspectRatio="1.5" MaxDepth="4">
+        <Camera Aperture="0" Time0="0" Time1="1" Vfov="20" FocusDist="10" AspectRatio="1.5">
+            <LookFrom x="13" y="2" z="3"/>
+            <LookAt x="0" y="0" z="0"/>
+            <Vup x="0" y="1" z="0"/>
+        </Camera>
+    </Engine>
+    <List>
+        <Sphere Radius="1"><Center x="0" y="0" z="0"/>
+            <Material><Lambertian><Color r="0.5" g="0.5" b="0.5"/></Lambertian></Material></Sphere>
+        <Sphere Radius="1"><Center x="2" y="0" z="0"/>
+            <Material><Lambertian><Color r="0.5" g="0.5" b="0.5"/></Lambertian></Material></Sphere>
+        <Sphere Radius="1"><Center x="4" y="0" z="0"/>
+            <Material><Lambertian><Color r="0.9" g="0.1" b="0.1"/></Lambertian></Material></Sphere>
+        <Sphere Radius="1"><Center x="6" y="0" z="0"/>
+            <Material><Lambertian><Color r="0.1" g="0.9" b="0.1"/></Lambertian></Material></Sphere>
+    </List>
+</Root>
+)";
+
+static void test_repeated_inline_materials(const std::string& dir) {
+    std::string path = dir + "/scene_test_materials.xml";
+    write_file(path, repeated_materials_scene);
+    Engine engine(path.c_str());
+
+    check(engine.getWorld().objects.size() == 4, "inline materials: all spheres loaded");
+    color grey(0.5, 0.5, 0.5), red(0.9, 0.1, 0.1), green(0.1, 0.9, 0.1);
+    check(same_color(sphere_albedo(engine, 0), grey) && same_color(sphere_albedo(engine, 1), grey),
+          "inline materials: repeated material kept");
+    check(same_color(sphere_albedo(engine, 2), red), "inline materials: distinct material after a repeated one");
+    check(same_color(sphere_albedo(engine, 3), green), "inline materials: second distinct material");
+
+    auto s0 = std::dynamic_pointer_cast<sphere>(engine.getWorld().objects[0]);
+    auto s1 = std::dynamic_pointer_cast<sphere>(engine.getWorld().objects[1]);
+    check(s0 != nullptr && s1 != nullptr && s0->mat_ptr == s1->mat_ptr, "inline materials: equal materials shared");
+    remove(path.c_str());
+}
+
+// Settings of the engine kept by --convert, all away from their defaults
+static void test_binary_round_trip(const std::string& dir) {
+    std::string xml_path = dir + "/scene_test_convert.xml", binary_path = dir + "/scene_test_convert.rts";
+    write_file(xml_path, repeated_materials_scene);
+    Engine engine(xml_path.c_str());
+    engine.setPrecision(render_precision::float32);
+    engine.setIntegrator(render_integrator::wavefront);
+    engine.setRaySort(true);
+    engine.setPrimaryPackets(true);
+    engine.setBvhBuilder(bvh_builder::lbvh);
+    engine.saveBinaryScene(binary_path.c_str());
+
+    Engine loaded(binary_path.c_str());
+    check(loaded.getPrecision() == render_precision::float32, "convert: precision kept");
+    check(loaded.getIntegrator() == render_integrator::wavefront, "convert: integrator kept");
+    check(loaded.isRaySort(), "convert: ray sort kept");
+    check(loaded.isPrimaryPackets(), "convert: primary packets kept");
+    check(loaded.getBvhBuilder() == bvh_builder::lbvh, "convert: bvh builder kept");
+
+    bool same_objects = loaded.getWorld().objects.size() == engine.getWorld().objects.size();
+    for (size_t i = 0; same_objects && i < engine.getWorld().objects.size(); i++)
+        same_objects = same_color(sphere_albedo(loaded, i), sphere_albedo(engine, i));
+    check(same_objects, "convert: objects and materials kept");
+
+    remove(xml_path.c_str());
+    remove(binary_path.c_str());
+}
+
+// Render paths the settings of a scene fall back from are reported
+static void test_ignored_settings(const std::string& dir) {
+    std::string path = dir + "/scene_test_settings.xml";
+    std::string scene = repeated_materials_scene;
+    scene.replace(scene.find("<Engine "), 8, "<Engine Integrator=\"wavefront\" Adaptive=\"true\" RaySort=\"true\" ");
+    write_file(path, scene.c_str());
+    Engine engine(path.c_str());
+
+    std::string ignored = engine.ignoredSettings();
+    check(ignored.find("Integrator") != std::string::npos, "settings: wavefront with Adaptive reported");
+    check(ignored.find("RaySort") != std::string::npos, "settings: RaySort without wavefront reported");
+    engine.setAdaptive(false);
+    check(engine.ignoredSettings().empty(), "settings: wavefront with RaySort not reported");
+    remove(path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = "/tmp";
+    for (int i = 1; i < argc; i++)
+        if (strncmp(argv[i], "--dir=", 6) == 0) dir = argv[i]+6;
+
+    try {
+        test_repeated_inline_materials(dir);
+        test_binary_round_trip(dir);
+        test_ignored_settings(dir);
+    }
+    catch (const std::exception& e) {
+        printf("FAIL %s\n", e.what());
+        failures++;
+    }
+
+    if (failures > 0) printf("%d check(s) failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}